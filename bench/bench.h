@@ -0,0 +1,87 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+// Helpers shared by the benchmarks in this directory, each of them is
+// a separate program built against src/ and run by `nob bench`.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define WIN32_MEAN_AND_LEAN
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#define SB_IMPLEMENTATION
+#include "sb.h"
+#define DA_IMPLEMENTATION
+#include "da.h"
+#define ARENA_IMPLEMENTATION
+#include "arena.h"
+
+// Times every benchmark is repeated, the best run is reported
+#define BENCH_RUNS 5
+
+/*
+ * @return seconds from an arbitrary point, monotonic.
+ */
+static inline double bench_now(void) {
+#ifdef _WIN32
+  LARGE_INTEGER f, c;
+  QueryPerformanceFrequency(&f);
+  QueryPerformanceCounter(&c);
+  return (double)c.QuadPart / (double)f.QuadPart;
+#else
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (double)t.tv_sec + (double)t.tv_nsec * 1e-9;
+#endif
+}
+
+/*
+ * Generates a calendar of `events` one-hour events spread over ten
+ * years, with the text and folded descriptions of a shared team feed.
+ * @param sb buffer the calendar is appended to
+ */
+static inline void bench_feed(sb_t* sb, size_t events) {
+  srand(1);
+  sb_appendf(sb, "BEGIN:VCALENDAR\r\nVERSION:2.0\r\nPRODID:-//today//bench//EN\r\nX-WR-CALNAME:Bench\r\n");
+  for (size_t i = 0; i < events; i++) {
+    int y = 2020 + rand() % 10, m = 1 + rand() % 12, d = 1 + rand() % 28, h = rand() % 23;
+    sb_appendf(sb,
+      "BEGIN:VEVENT\r\n"
+      "UID:%zu-bench@example.com\r\n"
+      "DTSTAMP:20240101T000000Z\r\n"
+      "DTSTART:%04d%02d%02dT%02d0000Z\r\n"
+      "DTEND:%04d%02d%02dT%02d0000Z\r\n"
+      "SUMMARY:Meeting %d\r\n"
+      "LOCATION:Room %d\\, building %d\r\n"
+      "DESCRIPTION:Agenda: status of the project\\, open questions and next s\r\n"
+      " teps. Join the call at https://meet.example.com/%zu\r\n"
+      "CATEGORIES:Work\r\n"
+      "END:VEVENT\r\n",
+      i, y, m, d, h, y, m, d, h + 1, rand() % 50, rand() % 20, rand() % 5, i);
+  }
+  sb_appendf(sb, "END:VCALENDAR\r\n");
+}
+
+/*
+ * Reads the calendar named on the command line, or generates one
+ * of `events` events if there is none.
+ * @param sb buffer holding the calendar
+ */
+static inline void bench_input(int argc, char** argv, sb_t* sb, size_t events) {
+  if (argc > 1) {
+    if (sb_read_file(argv[1], sb) < 0) {
+      fprintf(stderr, "Failed to read file `%s`\n", argv[1]);
+      exit(1);
+    }
+  } else {
+    bench_feed(sb, events);
+  }
+}
+
+#endif // BENCH_H
@@ -0,0 +1,101 @@
+// Sorting events by start time: qsort with a mktime comparator (how
+// the events were sorted before the store), qsort on epoch keys, and
+// event_store_build, which radix sorts the keys and builds the index.
+// usage: bench_sort
+#include "bench.h"
+
+#include "ics.h"
+#include "store.h"
+#include "timestamp.h"
+
+// the mktime comparator is too slow to be worth running on more
+#define BENCH_MKTIME_MAX 100000
+
+typedef struct {
+  timestamp_t start;
+  int64_t epoch;
+} sort_item_t;
+
+static time_t sort_mktime(const timestamp_t* t) {
+  struct tm tm = {
+    .tm_year = t->y - 1900, .tm_mon = t->m - 1, .tm_mday = t->d,
+    .tm_hour = t->hh, .tm_min = t->mm, .tm_sec = t->ss, .tm_isdst = -1,
+  };
+  return mktime(&tm);
+}
+
+static int sort_cmp_mktime(const void* a, const void* b) {
+  time_t ta = sort_mktime(&((const sort_item_t*)a)->start);
+  time_t tb = sort_mktime(&((const sort_item_t*)b)->start);
+  return (ta > tb) - (ta < tb);
+}
+
+static int sort_cmp_epoch(const void* a, const void* b) {
+  int64_t ta = ((const sort_item_t*)a)->epoch;
+  int64_t tb = ((const sort_item_t*)b)->epoch;
+  return (ta > tb) - (ta < tb);
+}
+
+static double sort_qsort(const sort_item_t* items, size_t n, int (*cmp)(const void*, const void*), int runs) {
+  sort_item_t* copy = malloc(n * sizeof(*copy));
+  double best = 1e9;
+  for (int r = 0; r < runs; r++) {
+    memcpy(copy, items, n * sizeof(*copy));
+    double t = bench_now();
+    qsort(copy, n, sizeof(*copy), cmp);
+    t = bench_now() - t;
+    if (t < best) best = t;
+  }
+  free(copy);
+  return best;
+}
+
+int main(void) {
+  size_t sizes[] = { 10000, 100000, 1000000 };
+
+  printf("sort, random starts over ten years, 4 calendars\n");
+  printf("  %8s %14s %14s %18s\n", "events", "qsort mktime", "qsort epoch", "event_store_build");
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(*sizes); s++) {
+    size_t n = sizes[s];
+    sort_item_t* items = malloc(n * sizeof(*items));
+    calendararr_t calendars = { 0 };
+    srand(42);
+    for (int c = 0; c < 4; c++) da_append(&calendars, ((calendar_t){ 0 }));
+    for (size_t i = 0; i < n; i++) {
+      int64_t start = 1577836800LL + ((int64_t)rand() * 7 + rand()) % (10LL * 365 * 86400);
+      items[i] = (sort_item_t){ .start = timestamp_from_epoch(start), .epoch = start };
+      da_append(&calendars.items[i % 4].events, ((event_t){ .start = start, .end = start + 3600 }));
+    }
+
+    double t_mktime = n <= BENCH_MKTIME_MAX ? sort_qsort(items, n, sort_cmp_mktime, 1) : -1;
+    double t_epoch = sort_qsort(items, n, sort_cmp_epoch, BENCH_RUNS);
+
+    double t_store = 1e9;
+    for (int r = 0; r < BENCH_RUNS; r++) {
+      event_store_t store;
+      double t = bench_now();
+      if (event_store_build(&store, &calendars)) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+      }
+      t = bench_now() - t;
+      if (t < t_store) t_store = t;
+      for (size_t i = 1; i < store.count; i++) {
+        if (store.start[i] < store.start[i - 1]) {
+          fprintf(stderr, "event_store_build left the events unsorted\n");
+          return 1;
+        }
+      }
+      event_store_free(&store);
+    }
+
+    if (t_mktime >= 0) printf("  %8zu %11.2f ms", n, t_mktime * 1e3);
+    else printf("  %8zu %14s", n, "-");
+    printf(" %11.2f ms %15.2f ms\n", t_epoch * 1e3, t_store * 1e3);
+
+    da_foreach(calendar_t, c, &calendars) da_free(c->events);
+    da_free(calendars);
+    free(items);
+  }
+  return 0;
+}
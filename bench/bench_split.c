@@ -0,0 +1,60 @@
+// split() against the loop it replaced, which memcmp'd the separator
+// at every byte offset. Both results are checked to be the same.
+// usage: bench_split [calendar.ics]
+#include "bench.h"
+
+#include "slice.h"
+
+static void split_memcmp(slice_t* s, const char* sep, unsigned int limit, slicearr_t* sa) {
+  size_t start = 0;
+  size_t sep_len = strlen(sep);
+  for (size_t i = 0; i < s->size && (limit == 0 || sa->count < limit); i++) {
+    if (s->size - i >= sep_len && memcmp(s->data + i, sep, sep_len) == 0) {
+      da_append(sa, ((slice_t){ .data = s->data + start, .size = i - start }));
+      i += sep_len - 1;
+      start = i + 1;
+    }
+  }
+  da_append(sa, ((slice_t){ .data = s->data + start, .size = s->size - start }));
+}
+
+typedef void (*split_fn_t)(slice_t*, const char*, unsigned int, slicearr_t*);
+
+static double bench_split(split_fn_t fn, slice_t* s, const char* sep, slicearr_t* pieces) {
+  double best = 1e9;
+  for (int r = 0; r < BENCH_RUNS; r++) {
+    pieces->count = 0;
+    double t = bench_now();
+    fn(s, sep, 0, pieces);
+    t = bench_now() - t;
+    if (t < best) best = t;
+  }
+  return best;
+}
+
+int main(int argc, char** argv) {
+  sb_t feed = { 0 };
+  bench_input(argc, argv, &feed, 100000);
+  slice_t cal = { .data = feed.items, .size = feed.count };
+
+  const char* seps[] = { "\n", ":", "\r\n" };
+  const char* names[] = { "\\n", ":", "\\r\\n" };
+
+  printf("split, %.1f MB\n", cal.size / 1e6);
+  for (size_t k = 0; k < sizeof(seps) / sizeof(*seps); k++) {
+    slicearr_t old = { 0 };
+    slicearr_t new = { 0 };
+    double t_old = bench_split(split_memcmp, &cal, seps[k], &old);
+    double t_new = bench_split(split, &cal, seps[k], &new);
+    if (old.count != new.count || memcmp(old.items, new.items, old.count * sizeof(*old.items)) != 0) {
+      fprintf(stderr, "split(\"%s\") differs from the memcmp loop\n", names[k]);
+      return 1;
+    }
+    printf("  sep %-5s memcmp loop %8.1f MB/s   split %8.1f MB/s\n", names[k], cal.size / t_old / 1e6, cal.size / t_new / 1e6);
+    da_free(old);
+    da_free(new);
+  }
+
+  sb_free(&feed);
+  return 0;
+}
@@ -0,0 +1,66 @@
+// Cost of decoding a DTSTART/DTEND value with timestamp_parse against
+// the six sized_atoi calls it replaced. The decoded fields are checked
+// to be the same.
+// usage: bench_timestamp
+#include "bench.h"
+
+#include "slice.h"
+#include "timestamp.h"
+
+// distinct values, cycled through so they stay in cache
+#define VALUES 4096
+#define DECODES 5000000
+
+static timestamp_t decode_atoi(const char* d) {
+  return (timestamp_t){
+    .y  = sized_atoi(d, 4),
+    .m  = sized_atoi(d + 4, 2),
+    .d  = sized_atoi(d + 6, 2),
+    .hh = sized_atoi(d + 9, 2),
+    .mm = sized_atoi(d + 11, 2),
+    .ss = sized_atoi(d + 13, 2),
+  };
+}
+
+int main(void) {
+  static char values[VALUES][24];
+  static size_t sizes[VALUES];
+  srand(3);
+  for (size_t i = 0; i < VALUES; i++) {
+    snprintf(values[i], sizeof(values[i]), "%04d%02d%02dT%02d%02d%02d%s",
+      1990 + rand() % 50, 1 + rand() % 12, 1 + rand() % 28, rand() % 24, rand() % 60, rand() % 60, (i & 1) ? "Z" : "");
+    sizes[i] = strlen(values[i]);
+
+    timestamp_t a = decode_atoi(values[i]);
+    timestamp_t b = timestamp_from_epoch(timestamp_parse(values[i], sizes[i], NULL));
+    if (a.y != b.y || a.m != b.m || a.d != b.d || a.hh != b.hh || a.mm != b.mm || a.ss != b.ss) {
+      fprintf(stderr, "timestamp_parse(%s) differs from sized_atoi\n", values[i]);
+      return 1;
+    }
+  }
+
+  double best_atoi = 1e9;
+  double best_parse = 1e9;
+  long long acc = 0;
+  for (int r = 0; r < BENCH_RUNS; r++) {
+    double t = bench_now();
+    for (size_t i = 0; i < DECODES; i++) {
+      timestamp_t ts = decode_atoi(values[i % VALUES]);
+      acc += ts.y + ts.m + ts.d + ts.hh + ts.mm + ts.ss;
+    }
+    t = bench_now() - t;
+    if (t < best_atoi) best_atoi = t;
+
+    t = bench_now();
+    for (size_t i = 0; i < DECODES; i++) {
+      acc += timestamp_parse(values[i % VALUES], sizes[i % VALUES], NULL);
+    }
+    t = bench_now() - t;
+    if (t < best_parse) best_parse = t;
+  }
+
+  printf("timestamp, %d values\n", VALUES);
+  printf("  6 x sized_atoi    %6.1f ns per timestamp\n", best_atoi / DECODES * 1e9);
+  printf("  timestamp_parse   %6.1f ns per timestamp (%lld)\n", best_parse / DECODES * 1e9, acc);
+  return 0;
+}
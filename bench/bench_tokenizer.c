@@ -0,0 +1,83 @@
+// Throughput of the single-pass tokenizer against the line split it
+// replaced in parse_calendar: split() the buffer into lines, then every
+// line into key and value.
+// Both paths count the properties and the bytes of their names, which
+// must match: continuation lines of folded values are not properties.
+// usage: bench_tokenizer [calendar.ics]
+#include "bench.h"
+
+#include "ics.h"
+#include "slice.h"
+
+static size_t tokenize_split(slice_t* cal) {
+  size_t acc = 0;
+  slicearr_t lines = { 0 };
+  slicearr_t kv = { 0 };
+  split(cal, "\n", 0, &lines);
+  for (size_t i = 0; i < lines.count; i++) {
+    slice_t* l = &lines.items[i];
+    int folded = l->size > 0 && (l->data[0] == ' ' || l->data[0] == '\t');
+    kv.count = 0;
+    slice_trim(l);
+    split(l, ":", 1, &kv);
+    if (folded || l->size == 0) continue;
+
+    // the name ends at the first parameter
+    slice_t name = kv.items[0];
+    for (size_t j = 0; j < name.size; j++) {
+      if (name.data[j] == ';') {
+        name.size = j;
+        break;
+      }
+    }
+    acc += 1 + name.size;
+  }
+  da_free(lines);
+  da_free(kv);
+  return acc;
+}
+
+static size_t tokenize_lexer(slice_t* cal) {
+  size_t acc = 0;
+  ics_lexer_t lx;
+  ics_token_t tok;
+  ics_lexer_init(&lx, *cal);
+  while (ics_next_token(&lx, &tok)) acc += 1 + tok.name.size;
+  return acc;
+}
+
+int main(int argc, char** argv) {
+  sb_t feed = { 0 };
+  bench_input(argc, argv, &feed, 100000);
+  slice_t cal = { .data = feed.items, .size = feed.count };
+
+  struct {
+    const char* name;
+    size_t (*fn)(slice_t*);
+  } paths[] = {
+    { "split() lines + key/value", tokenize_split },
+    { "ics_next_token",            tokenize_lexer },
+  };
+
+  printf("tokenizer, %.1f MB\n", cal.size / 1e6);
+  size_t expected = 0;
+  for (size_t p = 0; p < sizeof(paths) / sizeof(*paths); p++) {
+    double best = 1e9;
+    for (int r = 0; r < BENCH_RUNS; r++) {
+      double t = bench_now();
+      size_t acc = paths[p].fn(&cal);
+      t = bench_now() - t;
+      if (t < best) best = t;
+
+      if (p == 0 && r == 0) expected = acc;
+      if (acc != expected) {
+        fprintf(stderr, "%s: checksum %zu, expected %zu\n", paths[p].name, acc, expected);
+        return 1;
+      }
+    }
+    printf("  %-26s %8.1f MB/s\n", paths[p].name, cal.size / best / 1e6);
+  }
+
+  sb_free(&feed);
+  return 0;
+}
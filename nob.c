@@ -17,11 +17,65 @@
 #define BIN_DIR   "bin"   OS_SEP
 #define SRC_DIR   "src"   OS_SEP
 
+#define BENCH_DIR "bench" OS_SEP
+
 #define EXECUTABLE "today" EXE_EXT
 
+// Builds every bench/*.c with optimizations against the sources of the
+// application (except main.c) and runs it.
+bool bench(Nob_File_Paths* sources) {
+  Nob_Cmd cmd = { 0 };
+  Nob_File_Paths benches = { 0 };
+  if (!nob_read_entire_dir(BENCH_DIR, &benches)) return false;
+
+  nob_da_foreach(const char*, b, &benches) {
+    if (memcmp(".c", *b + strlen(*b) - 2, 2) != 0) continue;
+    const char* exe_path = nob_temp_sprintf(BIN_DIR "%.*s" EXE_EXT, (int)(strlen(*b) - 2), *b);
+    nob_cc(&cmd);
+#if defined(_MSC_VER)
+    nob_cmd_append(&cmd,"/nologo");
+    nob_cmd_append(&cmd,"/W4");
+    nob_cmd_append(&cmd,"/O2");
+    nob_cmd_append(&cmd,"/I" SRC_DIR);
+    nob_cmd_append(&cmd,nob_temp_sprintf("/Fe:%s", exe_path));
+    nob_cmd_append(&cmd,nob_temp_sprintf("/Fo:%s", BUILD_DIR));
+#elif defined(__GNUC__) || defined(__MINGW32__)
+    nob_cmd_append(&cmd,"-Wall");
+    nob_cmd_append(&cmd,"-Wextra");
+    nob_cmd_append(&cmd,"-O2");
+    nob_cmd_append(&cmd,"-I" SRC_DIR);
+    nob_cmd_append(&cmd,"-o");
+    nob_cmd_append(&cmd,exe_path);
+#endif
+    nob_cmd_append(&cmd,"-DNDEBUG");
+    nob_cmd_append(&cmd, nob_temp_sprintf(BENCH_DIR "%s", *b));
+    nob_da_foreach(const char*, s, sources) {
+      if (memcmp(".c", *s + strlen(*s) - 2, 2) != 0) continue;
+      if (strcmp(*s, "main.c") == 0) continue;
+      nob_cmd_append(&cmd, nob_temp_sprintf(SRC_DIR "%s", *s));
+    }
+#if defined(_MSC_VER)
+    nob_cmd_append(&cmd,"Wininet.lib");
+#elif defined(__GNUC__) || defined(__MINGW32__)
+    nob_cmd_append(&cmd,"-lpthread");
+#endif
+    if (!nob_cmd_run(&cmd)) return false;
+
+    nob_cmd_append(&cmd, exe_path);
+    if (!nob_cmd_run(&cmd)) return false;
+  }
+
+  return true;
+}
+
 int main(int argc, char **argv) {
   NOB_GO_REBUILD_URSELF(argc, argv);
 
+  const char* program = nob_shift(argv, argc);
+  (void)program;
+  // `nob bench` builds and runs the benchmarks instead of the application
+  int f_bench = argc > 0 && strcmp(argv[0], "bench") == 0;
+
   nob_mkdir_if_not_exists(BUILD_DIR);
   nob_mkdir_if_not_exists(BIN_DIR);
 
@@ -33,6 +87,8 @@ int main(int argc, char **argv) {
 
   nob_read_entire_dir(SRC_DIR, &sources);
 
+  if (f_bench) return bench(&sources) ? 0 : 1;
+
   // compile objects
   nob_da_foreach(const char*, s, &sources) {
     if (memcmp(".c", *s + strlen(*s) - 2, 2) != 0) continue;
@@ -85,6 +141,7 @@ int main(int argc, char **argv) {
   nob_cmd_append(&cmd,"-L/usr/local/ssl/lib64");
   nob_cmd_append(&cmd,"-lssl");
   nob_cmd_append(&cmd,"-lcrypto");
+  nob_cmd_append(&cmd,"-lpthread");
 #endif
   if (!nob_cmd_run(&cmd)) return 1;
 
@@ -39,6 +39,8 @@ typedef struct {
 void* arena_alloc(arena_t*, size_t);
 void arena_free(arena_t*);
 char* arena_strdup(arena_t*, const char*);
+char* arena_sprintf(arena_t*, const char*, ...);
+void arena_splice(arena_t*, arena_t*);
 
 #ifdef ARENA_IMPLEMENTATION
 
@@ -90,6 +92,23 @@ void arena_free(arena_t *a) {
   a->block_count = 0;
 }
 
+// Moves all the blocks of src to the end of dst, src is left empty.
+void arena_splice(arena_t* dst, arena_t* src) {
+  if (!dst || !src || src->head == NULL) return;
+
+  if (dst->head == NULL) {
+    *dst = *src;
+  } else {
+    dst->current->next = src->head;
+    dst->current = src->current;
+    dst->block_count += src->block_count;
+  }
+
+  src->head = NULL;
+  src->current = NULL;
+  src->block_count = 0;
+}
+
 char* arena_strdup(arena_t* a, const char* str) {
   size_t len = strlen(str) + 1;
   char* copy = (char*)arena_alloc(a, len);
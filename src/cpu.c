@@ -0,0 +1,20 @@
+#include "cpu.h"
+
+#ifdef CPU_X86_64
+int cpu_has_avx2(void) {
+#ifdef _MSC_VER
+  int info[4] = { 0 };
+  __cpuid(info, 0);
+  if (info[0] < 7) return 0;
+  __cpuid(info, 1);
+  // OSXSAVE and AVX, then make sure the OS saves the ymm registers
+  if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0) return 0;
+  if ((_xgetbv(0) & 6) != 6) return 0;
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#else
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif // CPU_X86_64
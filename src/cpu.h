@@ -0,0 +1,38 @@
+#ifndef CPU_H
+#define CPU_H
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define CPU_X86_64
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+static inline unsigned int popcount32(unsigned int x) {
+#ifdef _MSC_VER
+  return __popcnt(x);
+#else
+  return (unsigned int)__builtin_popcount(x);
+#endif
+}
+
+static inline unsigned int ctz32(unsigned int x) {
+#ifdef _MSC_VER
+  unsigned long i;
+  _BitScanForward(&i, x);
+  return (unsigned int)i;
+#else
+  return (unsigned int)__builtin_ctz(x);
+#endif
+}
+
+/*
+ * @return 1 if both the processor and the OS support AVX2.
+ */
+int cpu_has_avx2(void);
+#endif // x86_64
+
+#endif // CPU_H
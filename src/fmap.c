@@ -0,0 +1,83 @@
+#include "fmap.h"
+
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static int fmap_map(const char* filename, fmap_t* fm) {
+#ifdef _WIN32
+  HANDLE hFile = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if (hFile == INVALID_HANDLE_VALUE) return -1;
+
+  LARGE_INTEGER liFileSize = { 0 };
+  if (!GetFileSizeEx(hFile, &liFileSize) || liFileSize.QuadPart == 0) {
+    CloseHandle(hFile);
+    return -1;
+  }
+
+  HANDLE hMapping = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+  // the mapping keeps the file open
+  CloseHandle(hFile);
+  if (hMapping == NULL) return -1;
+
+  LPVOID view = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+  if (view == NULL) {
+    CloseHandle(hMapping);
+    return -1;
+  }
+
+  fm->mapping = hMapping;
+  fm->view = (slice_t){ .data = (char*)view, .size = (size_t)liFileSize.QuadPart };
+#else
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) return -1;
+
+  struct stat st = { 0 };
+  if (fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size == 0) {
+    close(fd);
+    return -1;
+  }
+
+  void* view = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // the mapping keeps the file open
+  close(fd);
+  if (view == MAP_FAILED) return -1;
+
+  madvise(view, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+  fm->view = (slice_t){ .data = (char*)view, .size = (size_t)st.st_size };
+#endif
+  fm->mapped = 1;
+  return 0;
+}
+
+long long fmap_open(const char* filename, fmap_t* fm) {
+  memset(fm, 0, sizeof(*fm));
+
+  if (fmap_map(filename, fm) == 0) return (long long)fm->view.size;
+
+  int read = sb_read_file(filename, &fm->sb);
+  if (read < 0) return -1;
+
+  fm->view = (slice_t){ .data = fm->sb.items, .size = fm->sb.count };
+  return read;
+}
+
+void fmap_close(fmap_t* fm) {
+  if (fm->mapped) {
+#ifdef _WIN32
+    UnmapViewOfFile(fm->view.data);
+    CloseHandle(fm->mapping);
+#else
+    munmap(fm->view.data, fm->view.size);
+#endif
+  } else if (fm->sb.items) {
+    sb_free(&fm->sb);
+  }
+  memset(fm, 0, sizeof(*fm));
+}
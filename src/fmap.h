@@ -0,0 +1,40 @@
+#ifndef FMAP_H
+#define FMAP_H
+
+#include <stddef.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+
+#include "sb.h"
+#include "slice.h"
+
+/*
+ * Read-only view of a whole file. The file is memory mapped when
+ * possible, otherwise it is read into `sb`.
+ */
+typedef struct {
+  slice_t view;
+  int mapped;
+  sb_t sb;
+#ifdef _WIN32
+  HANDLE mapping;
+#endif
+} fmap_t;
+
+/*
+ * Maps filename in memory, falls back to sb_read_file.
+ * @param filename path of the file to read
+ * @param fm pointer to fmap_t structure that will hold the view
+ * @return If >= 0 the size of the file, if < 0 error.
+ */
+long long fmap_open(const char* filename, fmap_t* fm);
+/*
+ * Unmaps the file, or frees the buffer it was read into.
+ * @param fm pointer to fmap_t structure
+ */
+void fmap_close(fmap_t* fm);
+
+#endif // FMAP_H
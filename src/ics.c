@@ -0,0 +1,900 @@
+#include "ics.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "da.h"
+#include "logging.h"
+#include "thread.h"
+
+#define IS_FOLD(c) ((c) == ' ' || (c) == '\t')
+
+void ics_lexer_init(ics_lexer_t* lx, slice_t src) {
+  lx->src = src;
+  lx->pos = 0;
+  lx->line = 0;
+}
+
+int ics_next_token(ics_lexer_t* lx, ics_token_t* tok) {
+  const char* data = lx->src.data;
+  size_t size = lx->src.size;
+
+  if (!data) return 0;
+
+  while (lx->pos < size) {
+    size_t i = lx->pos;
+
+    tok->line = ++lx->line;
+    tok->folded = 0;
+
+    while (i < size && IS_FOLD(data[i])) i++;
+
+    // name
+    size_t name_start = i;
+    while (i < size && data[i] != ':' && data[i] != ';' && data[i] != '\n') i++;
+    size_t name_end = i;
+    while (name_end > name_start && isspace((unsigned char)data[name_end - 1])) name_end--;
+
+    // parameters, ':' is allowed inside quoted values
+    size_t params_start = i;
+    size_t params_end = i;
+    if (i < size && data[i] == ';') {
+      int quoted = 0;
+      params_start = ++i;
+      while (i < size && data[i] != '\n' && (quoted || data[i] != ':')) {
+        if (data[i] == '"') quoted = !quoted;
+        i++;
+      }
+      params_end = i;
+    }
+
+    // value, up to the end of the logical line
+    if (i < size && data[i] == ':') i++;
+    size_t value_start = i;
+    for (;;) {
+      const char* nl = memchr(data + i, '\n', size - i);
+      if (!nl) {
+        i = size;
+        break;
+      }
+      i = (size_t)(nl - data) + 1;
+      if (i < size && IS_FOLD(data[i])) {
+        tok->folded = 1;
+        lx->line++;
+        continue;
+      }
+      break;
+    }
+    lx->pos = i;
+
+    size_t value_end = i;
+    while (value_end > value_start && isspace((unsigned char)data[value_end - 1])) value_end--;
+    if (value_start > value_end) value_start = value_end;
+
+    if (name_end == name_start && value_end == value_start) continue;
+
+    tok->name   = (slice_t){ .data = (char*)data + name_start,   .size = name_end - name_start };
+    tok->params = (slice_t){ .data = (char*)data + params_start, .size = params_end - params_start };
+    tok->value  = (slice_t){ .data = (char*)data + value_start,  .size = value_end - value_start };
+    return 1;
+  }
+
+  return 0;
+}
+
+// Finds a line made of pattern (which starts with '\n'), ignoring
+// trailing whitespace like the lexer does.
+static size_t find_line(const slice_t* src, size_t from, const char* pattern, size_t len) {
+  for (;;) {
+    size_t i = slice_find(src, from, pattern, len);
+    if (i >= src->size) return src->size;
+
+    size_t j = i + len;
+    while (j < src->size && (src->data[j] == ' ' || src->data[j] == '\t')) j++;
+    if (j == src->size || src->data[j] == '\r' || src->data[j] == '\n') return i;
+    from = i + 1;
+  }
+}
+
+// Longest component name we jump over, longer ones are tokenized
+#define SKIP_NAME_MAX 64
+
+int ics_skip_component(ics_lexer_t* lx, const slice_t* name) {
+  const slice_t* src = &lx->src;
+  if (!src->data || lx->pos == 0 || lx->pos >= src->size || src->data[lx->pos - 1] != '\n') return 0;
+  if (name->size == 0 || name->size > SKIP_NAME_MAX) return 0;
+
+  char begin[sizeof("\nBEGIN:") + SKIP_NAME_MAX];
+  char end[sizeof("\nEND:") + SKIP_NAME_MAX];
+  size_t begin_len = sizeof("\nBEGIN:") - 1 + name->size;
+  size_t end_len = sizeof("\nEND:") - 1 + name->size;
+  memcpy(begin, "\nBEGIN:", sizeof("\nBEGIN:") - 1);
+  memcpy(begin + sizeof("\nBEGIN:") - 1, name->data, name->size);
+  memcpy(end, "\nEND:", sizeof("\nEND:") - 1);
+  memcpy(end + sizeof("\nEND:") - 1, name->data, name->size);
+
+  // the '\n' before the first line is part of the patterns
+  size_t pos = lx->pos - 1;
+  size_t depth = 1;
+  for (;;) {
+    size_t e = find_line(src, pos, end, end_len);
+    if (e >= src->size) return 0;
+
+    slice_t head = { .data = src->data, .size = e };
+    size_t b = find_line(&head, pos, begin, begin_len);
+    if (b < e) {
+      depth++;
+      pos = b + 1;
+      continue;
+    }
+    if (--depth == 0) {
+      pos = e + 1;
+      break;
+    }
+    pos = e + 1;
+  }
+
+  slice_t skipped = { .data = src->data + lx->pos, .size = pos - lx->pos };
+  lx->line += slice_count(&skipped, '\n');
+  lx->pos = pos;
+
+  return 1;
+}
+
+#define LEX_DONE 1
+
+// Smaller calendars are not worth the threads
+#define PARALLEL_MIN_SIZE (1 << 20)
+// More ranges than threads, so that a slow range doesn't stall the rest
+#define RANGES_PER_THREAD 4
+
+#define PARSE_ERROR(p, fmt, ...) do { if (!(p)->quiet) LOG_ERROR(fmt, ##__VA_ARGS__); } while (0)
+
+void ics_parser_init(ics_parser_t* p, arena_t* arena, const char* filename, calendar_t* calendar) {
+  memset(p, 0, sizeof(*p));
+  p->arena = arena;
+  p->filename = filename;
+  p->calendar = calendar;
+  p->start = TIMESTAMP_INVALID;
+  p->end = TIMESTAMP_INVALID;
+  p->recurrence_id = TIMESTAMP_INVALID;
+}
+
+static slice_t parser_copy(ics_parser_t* p, slice_t value) {
+  if (!p->copy || value.size == 0) return value;
+
+  char* data = arena_alloc(p->arena, value.size);
+  if (!data) return (slice_t){ 0 };
+  memcpy(data, value.data, value.size);
+
+  return (slice_t){ .data = data, .size = value.size };
+}
+
+#define EVENT_TEXT_FIELDS(e) { &(e)->uid, &(e)->summary, &(e)->location, &(e)->geo, &(e)->cat }
+
+// Event text is only copied to the arena at END:VEVENT, when we know
+// the event is kept. Until then it waits in `scratch`.
+static slice_t parser_text(ics_parser_t* p, slice_t value) {
+  if (!p->copy || value.size == 0) return value;
+
+  slice_t* fields[] = EVENT_TEXT_FIELDS(&p->event);
+  size_t offsets[sizeof(fields) / sizeof(*fields)] = { 0 };
+  size_t count = sizeof(fields) / sizeof(*fields);
+
+  // appending may move the buffer
+  for (size_t i = 0; i < count; i++) {
+    if (fields[i]->size > 0) offsets[i] = (size_t)(fields[i]->data - p->scratch.items);
+  }
+  if (sb_n_append(&p->scratch, value.data, value.size) < 0) return (slice_t){ 0 };
+  for (size_t i = 0; i < count; i++) {
+    if (fields[i]->size > 0) fields[i]->data = p->scratch.items + offsets[i];
+  }
+
+  return (slice_t){ .data = p->scratch.items + p->scratch.count - value.size, .size = value.size };
+}
+
+// Like parser_copy, but values seen before share their copy
+static slice_t parser_intern(ics_parser_t* p, slice_t value) {
+  if (!p->copy || !p->strings) return parser_copy(p, value);
+  return intern(p->strings, value);
+}
+
+static void parser_commit_text(ics_parser_t* p) {
+  if (!p->copy) return;
+
+  // UIDs repeat across overrides of the same event and copies of it in
+  // other calendars, the other fields a lot in recurring feeds
+  event_t* e = &p->event;
+  slice_t* fields[] = { &e->uid, &e->summary, &e->location, &e->geo, &e->cat };
+  for (size_t i = 0; i < sizeof(fields) / sizeof(*fields); i++) {
+    *fields[i] = parser_intern(p, *fields[i]);
+  }
+}
+
+static void parser_reset_event(ics_parser_t* p) {
+  memset(&p->event, 0, sizeof(p->event));
+  p->start = TIMESTAMP_INVALID;
+  p->end = TIMESTAMP_INVALID;
+  p->start_flags = 0;
+  p->end_flags = 0;
+  p->start_tz = NULL;
+  p->end_tz = NULL;
+  p->has_duration = 0;
+  p->recurs = 0;
+  p->recurrence_id = TIMESTAMP_INVALID;
+  p->recurrence_id_flags = 0;
+  p->recurrence_id_tz = NULL;
+  p->exdates.count = 0;
+  p->scratch.count = 0;
+}
+
+// UTC offsets go from -12:00 to +14:00, a local time can be
+// this far from the same time in UTC.
+#define LOCAL_SLACK (14 * 3600)
+
+static int64_t parser_utc(int64_t t, int flags, const tz_t* tz) {
+  if (flags & TIMESTAMP_UTC) return t;
+  return tz ? tz_local_to_utc(tz, t) : timestamp_local_to_utc(t);
+}
+
+// Zone of a DATE-TIME with a TZID parameter. Unknown zones are NULL
+// too, their times are read as local time.
+static const tz_t* parser_tz(ics_parser_t* p, slice_t params, int flags) {
+  if (params.size == 0 || (flags & (TIMESTAMP_UTC | TIMESTAMP_DATE))) return NULL;
+
+  // walk the parameters one by one, quoted values may hold ';' and
+  // other parameters may end in "TZID=" (X-FOO-TZID=...)
+  slice_t id = { 0 };
+  for (size_t i = 0; i < params.size && id.data == NULL;) {
+    size_t end = i;
+    int quoted = 0;
+    while (end < params.size && (quoted || params.data[end] != ';')) {
+      if (params.data[end] == '"') quoted = !quoted;
+      end++;
+    }
+    slice_t name = { .data = params.data + i, .size = end - i < 5 ? end - i : 5 };
+    if (slice_eq_nocase(&name, "TZID=")) id = (slice_t){ .data = params.data + i + 5, .size = end - i - 5 };
+    i = end + 1;
+  }
+  if (id.data == NULL) return NULL;
+
+  if (id.size == p->tzid_size && memcmp(id.data, p->tzid, id.size) == 0) return p->tzid_zone;
+
+  const tz_t* tz = tz_get(id);
+  if (id.size <= sizeof(p->tzid)) {
+    memcpy(p->tzid, id.data, id.size);
+    p->tzid_size = id.size;
+    p->tzid_zone = tz;
+  }
+  return tz;
+}
+
+// parser_out_of_window results
+#define OUT_FUTURE 1 // starts after the window
+#define OUT_PAST   2 // ends before the window, unless it recurs
+
+// Times not in UTC are only converted for the events we keep,
+// until then they are compared with some slack.
+static int parser_out_of_window(ics_parser_t* p) {
+  const ics_window_t* w = p->window;
+  if (!w) return 0;
+  // it may cancel an occurrence in the window, see parser_index_event
+  if (p->recurrence_id != TIMESTAMP_INVALID) return 0;
+
+  if (p->start != TIMESTAMP_INVALID) {
+    int64_t slack = p->start_flags & TIMESTAMP_UTC ? 0 : LOCAL_SLACK;
+    if (p->start - slack >= w->end) return OUT_FUTURE;
+  }
+  if (p->end != TIMESTAMP_INVALID && !p->recurs) {
+    int64_t slack = p->end_flags & TIMESTAMP_UTC ? 0 : LOCAL_SLACK;
+    if (p->end + slack < w->start) return OUT_PAST;
+  }
+
+  return 0;
+}
+
+// Asks parser_run to drop the current event. Events are only dropped
+// if the rest of them has no RECURRENCE-ID, past events if it has no
+// RRULE either.
+static void parser_skip_event(ics_parser_t* p, int out) {
+  p->skip = (slice_t){ .data = "VEVENT", .size = 6 };
+  p->skip_recheck = out == OUT_PAST;
+}
+
+// Jumps to END:VEVENT, the event stays as it is when its end is not
+// in the buffer or it turns out to recur: END:VEVENT drops it if needed.
+static void parser_drop_event(ics_parser_t* p, ics_lexer_t* lx) {
+  size_t pos = lx->pos;
+  size_t line = lx->line;
+  if (!ics_skip_component(lx, &p->skip)) return;
+
+  // lx->pos > 0 after a token, the block starts after a '\n'
+  slice_t block = { .data = lx->src.data + pos - 1, .size = lx->pos - pos + 1 };
+  if (slice_find(&block, 0, "\nRECURRENCE-ID", 14) < block.size
+      || (p->skip_recheck && slice_find(&block, 0, "\nRRULE", 6) < block.size)) {
+    lx->pos = pos;
+    lx->line = line;
+    return;
+  }
+
+  parser_reset_event(p);
+  p->parent = STATE_CAL;
+  p->depth = 1;
+  p->state = STATE_OTHER;
+}
+
+// Rules are stored in the arena, which doesn't align its allocations
+static const rrule_t* parser_store_rule(ics_parser_t* p) {
+  size_t align = sizeof(int64_t);
+  char* data = arena_alloc(p->arena, sizeof(rrule_t) + align - 1);
+  if (!data) return NULL;
+
+  rrule_t* r = (rrule_t*)(((uintptr_t)data + align - 1) & ~(uintptr_t)(align - 1));
+  *r = p->rule;
+  return r;
+}
+
+// @return 1 if the recurring event has an occurrence around the window.
+static int parser_recurs_in_window(ics_parser_t* p) {
+  const ics_window_t* w = p->window;
+  event_t* e = &p->event;
+  int64_t slack = p->start_flags & TIMESTAMP_UTC ? 0 : LOCAL_SLACK;
+
+  rrule_iter_t it;
+  rrule_iter_init(&it, &p->rule, w->start - (e->end - e->start) - slack);
+
+  int64_t t = 0;
+  return rrule_next(&it, &t) && t < w->end + slack;
+}
+
+// Fills the times of the event at END:VEVENT.
+// @return 0 if the event has to be dropped.
+// Reads a dur-value (RFC 5545, 3.3.6) like P1W, P2DT1H or -PT15M.
+// @return 0 on success, -1 if it is malformed
+static int parser_duration(slice_t value, int64_t* days, int64_t* seconds) {
+  size_t i = 0;
+  int sign = 1;
+  if (i < value.size && (value.data[i] == '+' || value.data[i] == '-')) {
+    if (value.data[i] == '-') sign = -1;
+    i++;
+  }
+  if (i >= value.size || value.data[i] != 'P') return -1;
+  i++;
+
+  *days = 0;
+  *seconds = 0;
+  int time = 0, parts = 0;
+  while (i < value.size) {
+    if (value.data[i] == 'T' && !time) {
+      time = 1;
+      i++;
+      continue;
+    }
+    int64_t n = 0;
+    size_t digits = 0;
+    while (i < value.size && isdigit((unsigned char)value.data[i]) && digits < 9) {
+      n = n * 10 + (value.data[i++] - '0');
+      digits++;
+    }
+    if (digits == 0 || i >= value.size) return -1;
+
+    switch (value.data[i++]) {
+      case 'W': if (time) return -1; *days += 7 * n; break;
+      case 'D': if (time) return -1; *days += n; break;
+      case 'H': if (!time) return -1; *seconds += 3600 * n; break;
+      case 'M': if (!time) return -1; *seconds += 60 * n; break;
+      case 'S': if (!time) return -1; *seconds += n; break;
+      default: return -1;
+    }
+    parts++;
+  }
+  if (parts == 0) return -1;
+
+  *days *= sign;
+  *seconds *= sign;
+  return 0;
+}
+
+static int parser_finish_event(ics_parser_t* p) {
+  event_t* e = &p->event;
+  if (p->start == TIMESTAMP_INVALID) return 0;
+
+  e->flags = 0;
+  if (p->start_flags & TIMESTAMP_DATE) e->flags |= EVENT_ALL_DAY;
+  if (!(p->start_flags & TIMESTAMP_UTC) && !p->start_tz) e->flags |= EVENT_FLOATING;
+  e->tz = p->start_tz;
+
+  e->start = parser_utc(p->start, p->start_flags, p->start_tz);
+  if (p->end != TIMESTAMP_INVALID) {
+    e->end = parser_utc(p->end, p->end_flags, p->end_tz);
+  } else if (p->has_duration) {
+    e->end = parser_utc(p->start + p->duration_days * 86400, p->start_flags, p->start_tz) + p->duration_seconds;
+  } else {
+    e->end = e->flags & EVENT_ALL_DAY ? parser_utc(p->start + 86400, p->start_flags, NULL) : e->start;
+  }
+
+  e->recurrence_id = p->recurrence_id != TIMESTAMP_INVALID
+    ? parser_utc(p->recurrence_id, p->recurrence_id_flags, p->recurrence_id_tz)
+    : TIMESTAMP_INVALID;
+
+  const ics_window_t* w = p->window;
+
+  if (p->recurs) {
+    rrule_bind(&p->rule, p->start, (p->start_flags & TIMESTAMP_UTC) != 0, p->start_tz);
+    if (w && !parser_recurs_in_window(p)) return 0;
+    e->rrule = parser_store_rule(p);
+    return e->rrule != NULL;
+  }
+
+  // events without a duration are kept if they start in the window
+  return !w || (e->start < w->end && (e->end > w->start || e->start >= w->start));
+}
+
+static void parser_exdates(ics_parser_t* p, slice_t params, slice_t value) {
+  size_t i = 0;
+  while (i < value.size) {
+    const char* comma = memchr(value.data + i, ',', value.size - i);
+    size_t end = comma ? (size_t)(comma - value.data) : value.size;
+
+    int flags = 0;
+    int64_t t = timestamp_parse(value.data + i, end - i, &flags);
+    if (t != TIMESTAMP_INVALID) da_append(&p->exdates, parser_utc(t, flags, parser_tz(p, params, flags)));
+    i = end + 1;
+  }
+}
+
+// Records the occurrences the event removes from its calendar: its
+// RECURRENCE-ID, and its EXDATEs if it is a recurring event we keep.
+// Text of kept events is already committed.
+static int parser_index_event(ics_parser_t* p, int keep) {
+  int exdates = keep && p->recurs && p->exdates.count > 0;
+  if (p->recurrence_id == TIMESTAMP_INVALID && !exdates) return 0;
+
+  slice_t uid = keep ? p->event.uid : parser_intern(p, p->event.uid);
+  instance_set_t* set = &p->calendar->exceptions;
+
+  if (p->recurrence_id != TIMESTAMP_INVALID) {
+    if (instance_set_add(set, uid, parser_utc(p->recurrence_id, p->recurrence_id_flags, p->recurrence_id_tz))) return -1;
+  }
+  if (exdates) {
+    for (size_t i = 0; i < p->exdates.count; i++) {
+      if (instance_set_add(set, uid, p->exdates.items[i])) return -1;
+    }
+  }
+  return 0;
+}
+
+#define MATCH(s, lit, id) \
+  if (memcmp((s)->data, lit, sizeof(lit) - 1) == 0) return id
+
+// Names only match with their exact length, the length picks the
+// few candidates worth comparing.
+ics_prop_t ics_prop_lookup(const slice_t* name) {
+  switch (name->size) {
+    case 3:
+      MATCH(name, "END", ICS_PROP_END);
+      MATCH(name, "UID", ICS_PROP_UID);
+      MATCH(name, "GEO", ICS_PROP_GEO);
+      break;
+    case 4:
+      MATCH(name, "TZID", ICS_PROP_TZID);
+      break;
+    case 5:
+      MATCH(name, "BEGIN", ICS_PROP_BEGIN);
+      MATCH(name, "DTEND", ICS_PROP_DTEND);
+      MATCH(name, "RRULE", ICS_PROP_RRULE);
+      break;
+    case 6:
+      MATCH(name, "EXDATE", ICS_PROP_EXDATE);
+      MATCH(name, "STATUS", ICS_PROP_STATUS);
+      break;
+    case 7:
+      MATCH(name, "SUMMARY", ICS_PROP_SUMMARY);
+      MATCH(name, "DTSTART", ICS_PROP_DTSTART);
+      MATCH(name, "DTSTAMP", ICS_PROP_DTSTAMP);
+      break;
+    case 8:
+      MATCH(name, "LOCATION", ICS_PROP_LOCATION);
+      MATCH(name, "SEQUENCE", ICS_PROP_SEQUENCE);
+      MATCH(name, "DURATION", ICS_PROP_DURATION);
+      break;
+    case 10:
+      MATCH(name, "CATEGORIES", ICS_PROP_CATEGORIES);
+      break;
+    case 11:
+      MATCH(name, "DESCRIPTION", ICS_PROP_DESCRIPTION);
+      break;
+    case 12:
+      MATCH(name, "X-WR-CALNAME", ICS_PROP_X_WR_CALNAME);
+      break;
+    case 13:
+      MATCH(name, "RECURRENCE-ID", ICS_PROP_RECURRENCE_ID);
+      MATCH(name, "X-WR-TIMEZONE", ICS_PROP_X_WR_TIMEZONE);
+      break;
+  }
+  return ICS_PROP_UNKNOWN;
+}
+
+ics_comp_t ics_comp_lookup(const slice_t* name) {
+  switch (name->size) {
+    case 5:
+      MATCH(name, "VTODO", ICS_COMP_VTODO);
+      break;
+    case 6:
+      MATCH(name, "VEVENT", ICS_COMP_VEVENT);
+      MATCH(name, "VALARM", ICS_COMP_VALARM);
+      break;
+    case 8:
+      MATCH(name, "STANDARD", ICS_COMP_STANDARD);
+      MATCH(name, "DAYLIGHT", ICS_COMP_DAYLIGHT);
+      MATCH(name, "VJOURNAL", ICS_COMP_VJOURNAL);
+      break;
+    case 9:
+      MATCH(name, "VCALENDAR", ICS_COMP_VCALENDAR);
+      MATCH(name, "VTIMEZONE", ICS_COMP_VTIMEZONE);
+      MATCH(name, "VFREEBUSY", ICS_COMP_VFREEBUSY);
+      break;
+  }
+  return ICS_COMP_UNKNOWN;
+}
+
+#undef MATCH
+
+// @return < 0 on error, LEX_DONE at END:VCALENDAR, 0 otherwise.
+static int parser_token(ics_parser_t* p, ics_token_t* tok) {
+  ics_prop_t prop = ics_prop_lookup(&tok->name);
+  slice_t value = tok->value;
+  size_t line = p->line + tok->line;
+  int out = 0;
+  int keep = 0;
+
+  if (p->state == STATE_OTHER) {
+    if (prop == ICS_PROP_BEGIN) {
+      p->depth++;
+    } else if (prop == ICS_PROP_END) {
+      if (--p->depth == 0) p->state = p->parent;
+    }
+    return 0;
+  }
+
+  switch (prop) {
+    case ICS_PROP_X_WR_CALNAME:
+      p->calendar->name = parser_intern(p, value);
+      break;
+    case ICS_PROP_BEGIN:
+      switch (ics_comp_lookup(&value)) {
+        case ICS_COMP_VEVENT:
+          if (p->state == STATE_EVENT) {
+            PARSE_ERROR(p, "%s:%zu: Unclosed event", p->filename, line);
+            return -1;
+          }
+          p->state = STATE_EVENT;
+          break;
+        case ICS_COMP_VCALENDAR:
+          if (p->state != STATE_UNDEF) {
+            PARSE_ERROR(p, "%s:%zu: Unexpected start of calendar", p->filename, line);
+            return -1;
+          }
+          p->state = STATE_CAL;
+          break;
+        default:
+          p->parent = p->state;
+          p->depth = 1;
+          p->state = STATE_OTHER;
+          p->skip = value;
+          break;
+      }
+      break;
+    case ICS_PROP_END:
+      switch (ics_comp_lookup(&value)) {
+        case ICS_COMP_VEVENT:
+          if (p->state != STATE_EVENT) {
+            PARSE_ERROR(p, "%s:%zu: Closing event before BEGIN:VEVENT", p->filename, line);
+            return -1;
+          }
+          keep = parser_finish_event(p);
+          if (keep) parser_commit_text(p);
+          if (parser_index_event(p, keep) < 0) {
+            PARSE_ERROR(p, "%s:%zu: Out of memory", p->filename, line);
+            return -1;
+          }
+          if (keep) {
+            p->event.cal_name = p->calendar->name;
+            da_append(&p->calendar->events, p->event); // copies
+          }
+          parser_reset_event(p);
+          break;
+        case ICS_COMP_VCALENDAR:
+          if (p->state != STATE_CAL) {
+            PARSE_ERROR(p, "%s:%zu: Unexpected end of calendar", p->filename, line);
+            return -1;
+          }
+          return LEX_DONE;
+        default:
+          break;
+      }
+      p->state = STATE_CAL;
+      break;
+    case ICS_PROP_SUMMARY:
+      if (p->state != STATE_EVENT) {
+        PARSE_ERROR(p, "%s:%zu: Summary outside of event.", p->filename, line);
+        return -1;
+      }
+      p->event.summary = parser_text(p, value);
+      break;
+    case ICS_PROP_DTSTART:
+      if (p->state != STATE_EVENT) {
+        PARSE_ERROR(p, "%s:%zu: Start time outside of event.", p->filename, line);
+        return -1;
+      }
+      p->start = timestamp_parse(value.data, value.size, &p->start_flags);
+      p->start_tz = parser_tz(p, tok->params, p->start_flags);
+      if ((out = parser_out_of_window(p))) parser_skip_event(p, out);
+      break;
+    case ICS_PROP_DTEND:
+      if (p->state != STATE_EVENT) {
+        PARSE_ERROR(p, "%s:%zu: End time outside of event.", p->filename, line);
+        return -1;
+      }
+      p->end = timestamp_parse(value.data, value.size, &p->end_flags);
+      p->end_tz = parser_tz(p, tok->params, p->end_flags);
+      if ((out = parser_out_of_window(p))) parser_skip_event(p, out);
+      break;
+    case ICS_PROP_DURATION:
+      if (p->state != STATE_EVENT) break;
+      if (parser_duration(value, &p->duration_days, &p->duration_seconds) == 0) {
+        p->has_duration = 1;
+      } else {
+        LOG_DEBUG("%s:%zu: Invalid DURATION, ignored.", p->filename, line);
+      }
+      break;
+    case ICS_PROP_RRULE:
+      if (p->state != STATE_EVENT) break;
+      if (rrule_parse(value, &p->rule) == 0) {
+        p->recurs = 1;
+      } else {
+        LOG_DEBUG("%s:%zu: Unsupported RRULE, only the first occurrence is kept.", p->filename, line);
+      }
+      break;
+    case ICS_PROP_EXDATE:
+      if (p->state == STATE_EVENT) parser_exdates(p, tok->params, value);
+      break;
+    case ICS_PROP_RECURRENCE_ID:
+      if (p->state == STATE_EVENT) {
+        p->recurrence_id = timestamp_parse(value.data, value.size, &p->recurrence_id_flags);
+        p->recurrence_id_tz = parser_tz(p, tok->params, p->recurrence_id_flags);
+      }
+      break;
+    case ICS_PROP_DTSTAMP:
+      // always in UTC
+      if (p->state == STATE_EVENT) {
+        int64_t t = timestamp_parse(value.data, value.size, NULL);
+        if (t != TIMESTAMP_INVALID) p->event.dtstamp = t;
+      }
+      break;
+    case ICS_PROP_SEQUENCE:
+      if (p->state == STATE_EVENT) p->event.sequence = slice_atoi(&value);
+      break;
+    case ICS_PROP_UID:
+      if (p->state == STATE_EVENT) p->event.uid = parser_text(p, value);
+      break;
+    case ICS_PROP_LOCATION:
+      if (p->state == STATE_EVENT) p->event.location = parser_text(p, value);
+      break;
+    case ICS_PROP_GEO:
+      if (p->state == STATE_EVENT) p->event.geo = parser_text(p, value);
+      break;
+    case ICS_PROP_CATEGORIES:
+      if (p->state == STATE_EVENT) p->event.cat = parser_text(p, value);
+      break;
+    default:
+      break;
+  }
+
+  return 0;
+}
+
+// Parses a buffer made only of complete lines.
+static int parser_run(ics_parser_t* p, const char* data, size_t size) {
+  ics_lexer_t lx = { 0 };
+  ics_lexer_init(&lx, (slice_t){ .data = (char*)data, .size = size });
+
+  ics_token_t tok = { 0 };
+  while (!p->done && ics_next_token(&lx, &tok)) {
+    int res = parser_token(p, &tok);
+    if (res < 0) {
+      p->failed = 1;
+      return res;
+    }
+    if (res == LEX_DONE) p->done = 1;
+    // when its end is not in this buffer, the component is tokenized
+    if (p->skip.size > 0) {
+      if (p->state == STATE_EVENT) parser_drop_event(p, &lx);
+      else ics_skip_component(&lx, &p->skip);
+      p->skip = (slice_t){ 0 };
+    }
+  }
+  p->line += lx.line;
+
+  return 0;
+}
+
+// A logical line starts after a '\n' that is not followed by a
+// space or a tab. Looking at the next byte needs it to be in data,
+// so a '\n' at the very end of data is never a boundary.
+static int is_boundary(const char* data, size_t i, char prev) {
+  return prev == '\n' && data[i] != ' ' && data[i] != '\t';
+}
+
+int ics_parser_feed(ics_parser_t* p, const char* data, size_t size) {
+  if (p->failed) return -1;
+  // neither the chunks nor carry outlive this call
+  p->copy = 1;
+  if (p->done || size == 0) return 0;
+
+  size_t i = 0;
+
+  // complete the line left over by the previous chunk
+  if (p->carry.count > 0) {
+    char prev = p->carry.items[p->carry.count - 1];
+    while (i < size && !is_boundary(data, i, prev)) prev = data[i++];
+    if (i == size) {
+      if (sb_n_append(&p->carry, data, size) < 0) return -1;
+      return 0;
+    }
+    if (sb_n_append(&p->carry, data, i) < 0) return -1;
+    if (parser_run(p, p->carry.items, p->carry.count) < 0) return -1;
+    p->carry.count = 0;
+  }
+
+  size_t last = size;
+  while (last > i + 1 && !is_boundary(data, last - 1, data[last - 2])) last--;
+  last = last > i + 1 ? last - 1 : i;
+
+  if (last > i && parser_run(p, data + i, last - i) < 0) return -1;
+  if (size > last && sb_n_append(&p->carry, data + last, size - last) < 0) return -1;
+
+  return 0;
+}
+
+int ics_parser_finish(ics_parser_t* p) {
+  int res = p->failed ? -1 : 0;
+
+  if (!res && p->carry.count > 0) res = parser_run(p, p->carry.items, p->carry.count);
+
+  if (p->carry.items) sb_free(&p->carry);
+  if (p->scratch.items) sb_free(&p->scratch);
+  da_free(p->exdates);
+
+  return res;
+}
+
+typedef struct {
+  const char* data;
+  size_t size;
+  calendar_t calendar;
+  arena_t arena;
+  int failed;
+} parse_range_t;
+
+typedef struct {
+  parse_range_t* ranges;
+  size_t count;
+  const char* filename;
+  slice_t name;
+  const ics_window_t* window;
+} parse_ranges_t;
+
+static void parse_range(void* ctx, size_t job, size_t worker) {
+  (void)worker;
+  parse_ranges_t* pr = ctx;
+  parse_range_t* r = pr->ranges + job;
+
+  ics_parser_t p = { 0 };
+  ics_parser_init(&p, &r->arena, pr->filename, &r->calendar);
+  p.state = STATE_CAL;
+  p.quiet = 1;
+  p.window = pr->window;
+  r->calendar.name = pr->name;
+
+  // every range but the last must end between two events
+  r->failed = parser_run(&p, r->data, r->size) < 0
+           || (job + 1 < pr->count && (p.done || p.state != STATE_CAL));
+  da_free(p.exdates);
+}
+
+// Splits the events of cal in ranges starting at a BEGIN:VEVENT line
+// and parses them on separate threads, each one with its own arena.
+// @return 0 on success, 1 if the calendar has to be parsed serially.
+static int parse_calendar_parallel(arena_t* arena, slice_t* cal, const char* filename, calendar_t* calendar, const ics_window_t* window, size_t threads) {
+  const char* begin = "\nBEGIN:VEVENT";
+  size_t begin_len = strlen(begin);
+
+  size_t first = slice_find(cal, 0, begin, begin_len);
+  if (first >= cal->size) return 1;
+  first++;
+
+  // calendar properties and whatever comes before the first event
+  ics_parser_t header = { 0 };
+  ics_parser_init(&header, arena, filename, calendar);
+  header.quiet = 1;
+  if (parser_run(&header, cal->data, first) < 0 || header.state != STATE_CAL) return 1;
+
+  size_t count = threads * RANGES_PER_THREAD;
+  parse_range_t* ranges = calloc(count, sizeof(*ranges));
+  if (!ranges) return 1;
+
+  size_t n = 0;
+  size_t start = first;
+  size_t step = (cal->size - first) / count + 1;
+  while (start < cal->size && n < count) {
+    size_t end = n + 1 == count ? cal->size : slice_find(cal, start + step, begin, begin_len);
+    end = end < cal->size ? end + 1 : cal->size;
+    ranges[n++] = (parse_range_t){ .data = cal->data + start, .size = end - start };
+    start = end;
+  }
+
+  parse_ranges_t pr = { .ranges = ranges, .count = n, .filename = filename, .name = calendar->name, .window = window };
+  parallel_for(n, threads, parse_range, &pr);
+
+  int failed = 0;
+  for (size_t i = 0; i < n; i++) failed |= ranges[i].failed;
+
+  for (size_t i = 0; i < n; i++) {
+    if (!failed) {
+      eventarr_t* events = &ranges[i].calendar.events;
+      if (events->count > 0) da_append_many(&calendar->events, events->items, events->count);
+      failed = instance_set_merge(&calendar->exceptions, &ranges[i].calendar.exceptions);
+      arena_splice(arena, &ranges[i].arena);
+    } else {
+      arena_free(&ranges[i].arena);
+    }
+    da_free(ranges[i].calendar.events);
+    instance_set_free(&ranges[i].calendar.exceptions);
+  }
+  free(ranges);
+
+  return failed;
+}
+
+int parse_calendar(arena_t* arena, slice_t* cal, const char* filename, calendar_t* calendar, const ics_window_t* window, size_t threads) {
+  if (threads > 1 && cal->size >= PARALLEL_MIN_SIZE) {
+    if (parse_calendar_parallel(arena, cal, filename, calendar, window, threads) == 0) return 0;
+    // start over, errors are reported with the right line numbers
+    calendar->name = (slice_t){ 0 };
+    calendar->events.count = 0;
+    instance_set_free(&calendar->exceptions);
+  }
+
+  ics_parser_t p = { 0 };
+  ics_parser_init(&p, arena, filename, calendar);
+  p.window = window;
+
+  int res = parser_run(&p, cal->data, cal->size);
+  da_free(p.exdates);
+  return res;
+}
+
+void ics_print_text(FILE* f, slice_t text) {
+  size_t start = 0;
+
+  for (size_t i = 0; i < text.size; i++) {
+    char c = text.data[i];
+    if (c != '\\' && c != '\r' && c != '\n') continue;
+
+    fwrite(text.data + start, 1, i - start, f);
+
+    if (c == '\\' && i + 1 < text.size) {
+      char e = text.data[++i];
+      // escaped line breaks are printed as spaces, output is line based
+      fputc(e == 'n' || e == 'N' ? ' ' : e, f);
+    } else if (c == '\n' && i + 1 < text.size && (text.data[i + 1] == ' ' || text.data[i + 1] == '\t')) {
+      // folding, the whitespace is not part of the value
+      i++;
+    }
+    start = i + 1;
+  }
+
+  fwrite(text.data + start, 1, text.size - start, f);
+}
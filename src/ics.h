@@ -0,0 +1,284 @@
+#ifndef _ICS_H
+#define _ICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "arena.h"
+#include "instances.h"
+#include "intern.h"
+#include "rrule.h"
+#include "sb.h"
+#include "slice.h"
+#include "timestamp.h"
+#include "tz.h"
+
+/*
+ * A single content line of an iCalendar stream:
+ *   name *(";" param) ":" value
+ * All the slices point into the source buffer. Folded lines
+ * (CRLF followed by a space or a tab) are joined into one token,
+ * in that case `folded` is set and the value still contains the
+ * folding sequences.
+ */
+typedef struct {
+  slice_t name;
+  slice_t params;
+  slice_t value;
+  size_t line;
+  int folded;
+} ics_token_t;
+
+typedef struct {
+  slice_t src;
+  size_t pos;
+  size_t line;
+} ics_lexer_t;
+
+// event_t flags
+#define EVENT_ALL_DAY  1 // DTSTART is a DATE
+#define EVENT_FLOATING 2 // DTSTART has no time zone, it was read as local time
+
+// Times are seconds since the Unix epoch, in UTC. Events without
+// DTEND end after their DURATION, if they have one, or last one day
+// if they are all-day, no time otherwise.
+// Recurring events hold the times of DTSTART and their bound rule,
+// the occurrences are expanded when they are queried.
+// Text fields are raw (escaped, possibly folded) property values.
+// They point into the parsed buffer, or into the arena when the
+// parser copies them. Use ics_print_text to print them.
+typedef struct {
+  int64_t start;
+  int64_t end;
+  int64_t dtstamp;
+  // occurrence replaced by the event, TIMESTAMP_INVALID if none
+  int64_t recurrence_id;
+  int sequence;
+  unsigned int flags;
+  const rrule_t* rrule;
+  // zone of DTSTART when it has a TZID, the rule runs on its wall clock
+  const tz_t* tz;
+  slice_t uid;
+  slice_t cat;
+  slice_t summary;
+  slice_t location;
+  slice_t geo;
+  slice_t cal_name;
+} event_t;
+
+typedef struct {
+  event_t *items;
+  size_t count;
+  size_t capacity;
+} eventarr_t;
+
+typedef struct {
+  // const char* version;
+  slice_t name;
+  eventarr_t events;
+  // occurrences removed by EXDATE or replaced by a RECURRENCE-ID event
+  instance_set_t exceptions;
+} calendar_t;
+
+typedef struct {
+  calendar_t *items;
+  size_t count;
+  size_t capacity;
+} calendararr_t;
+
+typedef enum {
+  ICS_PROP_UNKNOWN = 0,
+  ICS_PROP_BEGIN,
+  ICS_PROP_END,
+  ICS_PROP_X_WR_CALNAME,
+  ICS_PROP_X_WR_TIMEZONE,
+  ICS_PROP_UID,
+  ICS_PROP_DTSTAMP,
+  ICS_PROP_DTSTART,
+  ICS_PROP_DTEND,
+  ICS_PROP_DURATION,
+  ICS_PROP_SUMMARY,
+  ICS_PROP_DESCRIPTION,
+  ICS_PROP_LOCATION,
+  ICS_PROP_GEO,
+  ICS_PROP_CATEGORIES,
+  ICS_PROP_STATUS,
+  ICS_PROP_SEQUENCE,
+  ICS_PROP_RRULE,
+  ICS_PROP_EXDATE,
+  ICS_PROP_RECURRENCE_ID,
+  ICS_PROP_TZID,
+} ics_prop_t;
+
+typedef enum {
+  ICS_COMP_UNKNOWN = 0,
+  ICS_COMP_VCALENDAR,
+  ICS_COMP_VEVENT,
+  ICS_COMP_VTODO,
+  ICS_COMP_VJOURNAL,
+  ICS_COMP_VFREEBUSY,
+  ICS_COMP_VTIMEZONE,
+  ICS_COMP_STANDARD,
+  ICS_COMP_DAYLIGHT,
+  ICS_COMP_VALARM,
+} ics_comp_t;
+
+typedef enum {
+  STATE_UNDEF = 0,
+  STATE_CAL,
+  STATE_EVENT,
+  STATE_OTHER,
+} parse_state_t;
+
+/*
+ * Time range [start, end), in seconds since the Unix epoch. Events
+ * not overlapping it are dropped while parsing, events without a
+ * duration are kept if they start inside it.
+ */
+typedef struct {
+  int64_t start;
+  int64_t end;
+} ics_window_t;
+
+/*
+ * Resumable parser state. The calendar can be fed in chunks of
+ * any size, lines split across chunks are kept in `carry`.
+ * When fed, text values are copied to the arena so the chunks
+ * can be reused as soon as ics_parser_feed returns.
+ */
+typedef struct {
+  arena_t* arena;
+  const char* filename;
+  calendar_t* calendar;
+  parse_state_t state;
+  // nested components we don't care about (VTIMEZONE, VALARM, ...)
+  parse_state_t parent;
+  size_t depth;
+  // component to jump over, set when entering STATE_OTHER or
+  // dropping the current event
+  slice_t skip;
+  int skip_recheck;
+  event_t event;
+  // DTSTART and DTEND of event as wall clock times (see
+  // timestamp_parse), TIMESTAMP_INVALID until known
+  int64_t start;
+  int64_t end;
+  int start_flags;
+  int end_flags;
+  // zones of the times with a TZID, NULL otherwise
+  const tz_t* start_tz;
+  const tz_t* end_tz;
+  // DURATION of event, used when it has no DTEND: whole days and weeks
+  // move the wall clock time of DTSTART, the rest is exact
+  int has_duration;
+  int64_t duration_days;
+  int64_t duration_seconds;
+  // RRULE of event, if any
+  rrule_t rule;
+  int recurs;
+  // RECURRENCE-ID of event as a wall clock time, TIMESTAMP_INVALID if none
+  int64_t recurrence_id;
+  int recurrence_id_flags;
+  const tz_t* recurrence_id_tz;
+  // EXDATE values of event, in UTC
+  struct {
+    int64_t* items;
+    size_t count;
+    size_t capacity;
+  } exdates;
+  // last TZID looked up and its zone
+  char tzid[64];
+  size_t tzid_size;
+  const tz_t* tzid_zone;
+  // if not NULL, events outside of it are dropped
+  const ics_window_t* window;
+  size_t line;
+  sb_t carry;
+  // text of the current event, when it has to be copied
+  sb_t scratch;
+  int done;
+  int failed;
+  // don't log errors
+  int quiet;
+  // copy text values to the arena instead of pointing into the source
+  int copy;
+  // if not NULL, copied text values are interned in it
+  intern_table_t* strings;
+} ics_parser_t;
+
+/*
+ * Initializes a lexer over src. The buffer is not copied and
+ * must outlive every token produced by the lexer.
+ * @param lx pointer to ics_lexer_t structure
+ * @param src buffer holding the calendar
+ */
+void ics_lexer_init(ics_lexer_t* lx, slice_t src);
+/*
+ * Reads the next content line, skipping empty lines.
+ * @param lx pointer to ics_lexer_t structure
+ * @param tok pointer to ics_token_t that will hold the token
+ * @return 1 if a token was read, 0 at the end of the buffer.
+ */
+int ics_next_token(ics_lexer_t* lx, ics_token_t* tok);
+/*
+ * Moves the lexer to the line closing the component that was just
+ * opened, without tokenizing the lines in between. Components with
+ * the same name nested inside it are skipped as well.
+ * @param lx pointer to ics_lexer_t structure, right after BEGIN:<name>
+ * @param name name of the component
+ * @return 1 if the next token is END:<name>, 0 if the end of the
+ *         component is not in the buffer and the lexer didn't move.
+ */
+int ics_skip_component(ics_lexer_t* lx, const slice_t* name);
+/*
+ * Maps a property name to its ics_prop_t, names must match exactly.
+ * @return the property, ICS_PROP_UNKNOWN if it is not one we know.
+ */
+ics_prop_t ics_prop_lookup(const slice_t* name);
+/*
+ * Maps a component name (the value of BEGIN and END) to its ics_comp_t.
+ * @return the component, ICS_COMP_UNKNOWN if it is not one we know.
+ */
+ics_comp_t ics_comp_lookup(const slice_t* name);
+
+/*
+ * Initializes a parser that appends to calendar.
+ * @param p pointer to ics_parser_t structure
+ * @param arena arena holding the parsed values
+ * @param filename name used in error messages
+ * @param calendar pointer to calendar_t that will hold the events
+ */
+void ics_parser_init(ics_parser_t* p, arena_t* arena, const char* filename, calendar_t* calendar);
+/*
+ * Pushes the next chunk of the calendar into the parser.
+ * @param p pointer to ics_parser_t structure
+ * @param data next bytes of the calendar
+ * @param size amount of bytes in data
+ * @return 0 on success, < 0 if the calendar is malformed.
+ */
+int ics_parser_feed(ics_parser_t* p, const char* data, size_t size);
+/*
+ * Parses whatever is left in the parser and releases its buffers.
+ * @param p pointer to ics_parser_t structure
+ * @return 0 on success, < 0 if the calendar is malformed.
+ */
+int ics_parser_finish(ics_parser_t* p);
+/*
+ * Parses a whole calendar held in memory. Large calendars are
+ * split at BEGIN:VEVENT lines and parsed on up to `threads`
+ * threads. Text fields point into cal, which must outlive
+ * the events.
+ * @param window if not NULL, only events around it are kept
+ * @return 0 on success, < 0 if the calendar is malformed.
+ */
+int parse_calendar(arena_t* arena, slice_t* cal, const char* filename, calendar_t* calendar, const ics_window_t* window, size_t threads);
+
+/*
+ * Prints a text value, unfolding it and resolving its escapes.
+ * @param f stream to print to
+ * @param text raw property value
+ */
+void ics_print_text(FILE* f, slice_t text);
+
+#endif
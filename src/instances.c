@@ -0,0 +1,89 @@
+#include "instances.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define INSTANCE_INIT_CAP 64
+
+uint64_t instance_hash(slice_t uid) {
+  return slice_hash(&uid);
+}
+
+// splitmix64 finalizer, spreads the instant over all the bits
+uint64_t instance_key(uint64_t uid_hash, int64_t instant) {
+  uint64_t x = uid_hash ^ ((uint64_t)instant * 0x9e3779b97f4a7c15ull);
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+  x ^= x >> 31;
+  return x ? x : 1;
+}
+
+static int instance_eq(const instance_t* a, uint64_t hash, slice_t uid, int64_t instant) {
+  return a->hash == hash && a->instant == instant
+      && a->uid.size == uid.size && memcmp(a->uid.data, uid.data, uid.size) == 0;
+}
+
+// @return 1 if the occurrence was not there yet.
+static int instance_insert(instance_t* items, size_t capacity, const instance_t* in) {
+  size_t mask = capacity - 1;
+  size_t i = (size_t)in->hash & mask;
+  while (items[i].hash != 0) {
+    if (instance_eq(items + i, in->hash, in->uid, in->instant)) return 0;
+    i = (i + 1) & mask;
+  }
+  items[i] = *in;
+  return 1;
+}
+
+// Keeps the load under 1/2
+static int instance_set_grow(instance_set_t* set, size_t count) {
+  if (count * 2 <= set->capacity) return 0;
+
+  size_t capacity = set->capacity ? set->capacity : INSTANCE_INIT_CAP;
+  while (count * 2 > capacity) capacity *= 2;
+
+  instance_t* items = calloc(capacity, sizeof(*items));
+  if (!items) return 1;
+  for (size_t i = 0; i < set->capacity; i++) {
+    if (set->items[i].hash != 0) instance_insert(items, capacity, set->items + i);
+  }
+
+  free(set->items);
+  set->items = items;
+  set->capacity = capacity;
+  return 0;
+}
+
+int instance_set_add(instance_set_t* set, slice_t uid, int64_t instant) {
+  if (instance_set_grow(set, set->count + 1)) return 1;
+
+  instance_t in = { .hash = instance_key(instance_hash(uid), instant), .instant = instant, .uid = uid };
+  set->count += instance_insert(set->items, set->capacity, &in);
+  return 0;
+}
+
+int instance_set_has(const instance_set_t* set, slice_t uid, uint64_t uid_hash, int64_t instant) {
+  if (set->count == 0) return 0;
+
+  uint64_t hash = instance_key(uid_hash, instant);
+  size_t mask = set->capacity - 1;
+  for (size_t i = (size_t)hash & mask; set->items[i].hash != 0; i = (i + 1) & mask) {
+    if (instance_eq(set->items + i, hash, uid, instant)) return 1;
+  }
+  return 0;
+}
+
+int instance_set_merge(instance_set_t* dst, const instance_set_t* src) {
+  if (src->count == 0) return 0;
+  if (instance_set_grow(dst, dst->count + src->count)) return 1;
+
+  for (size_t i = 0; i < src->capacity; i++) {
+    if (src->items[i].hash != 0) dst->count += instance_insert(dst->items, dst->capacity, src->items + i);
+  }
+  return 0;
+}
+
+void instance_set_free(instance_set_t* set) {
+  free(set->items);
+  memset(set, 0, sizeof(*set));
+}
@@ -0,0 +1,58 @@
+#ifndef INSTANCES_H
+#define INSTANCES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "slice.h"
+
+/*
+ * Occurrence of a recurring event, identified by the UID of the event
+ * and the UTC start of the occurrence (its RECURRENCE-ID).
+ */
+typedef struct {
+  // 0 marks an empty slot
+  uint64_t hash;
+  int64_t instant;
+  slice_t uid;
+} instance_t;
+
+/*
+ * Open addressing hash set of occurrences, used for the occurrences
+ * a calendar excludes (EXDATE) or overrides (RECURRENCE-ID).
+ * The UIDs are not copied and must outlive the set.
+ */
+typedef struct {
+  instance_t* items;
+  size_t count;
+  // power of two, or 0
+  size_t capacity;
+} instance_set_t;
+
+/*
+ * @return the hash of uid, to be passed to instance_set_has.
+ */
+uint64_t instance_hash(slice_t uid);
+/*
+ * @param uid_hash instance_hash of the UID
+ * @return the hash of an occurrence, never 0.
+ */
+uint64_t instance_key(uint64_t uid_hash, int64_t instant);
+/*
+ * Adds an occurrence to the set, adding it twice is harmless.
+ * @return 0 on success, 1 if out of memory.
+ */
+int instance_set_add(instance_set_t* set, slice_t uid, int64_t instant);
+/*
+ * @param uid_hash instance_hash(uid), computed once per event
+ * @return 1 if the occurrence is in the set.
+ */
+int instance_set_has(const instance_set_t* set, slice_t uid, uint64_t uid_hash, int64_t instant);
+/*
+ * Adds every occurrence of src to dst.
+ * @return 0 on success, 1 if out of memory.
+ */
+int instance_set_merge(instance_set_t* dst, const instance_set_t* src);
+void instance_set_free(instance_set_t* set);
+
+#endif // INSTANCES_H
@@ -0,0 +1,62 @@
+#include "intern.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define INTERN_INIT_CAP 256
+
+static size_t intern_slot(const intern_entry_t* items, size_t capacity, uint64_t hash, slice_t str) {
+  size_t mask = capacity - 1;
+  size_t i = (size_t)hash & mask;
+  while (items[i].str.data != NULL) {
+    const intern_entry_t* e = items + i;
+    if (e->hash == hash && e->str.size == str.size && memcmp(e->str.data, str.data, str.size) == 0) break;
+    i = (i + 1) & mask;
+  }
+  return i;
+}
+
+// Keeps the load under 1/2
+static int intern_grow(intern_table_t* t) {
+  if ((t->count + 1) * 2 <= t->capacity) return 0;
+
+  size_t capacity = t->capacity ? t->capacity * 2 : INTERN_INIT_CAP;
+  intern_entry_t* items = calloc(capacity, sizeof(*items));
+  if (!items) return 1;
+  for (size_t i = 0; i < t->capacity; i++) {
+    const intern_entry_t* e = t->items + i;
+    if (e->str.data != NULL) items[intern_slot(items, capacity, e->hash, e->str)] = *e;
+  }
+
+  free(t->items);
+  t->items = items;
+  t->capacity = capacity;
+  return 0;
+}
+
+slice_t intern(intern_table_t* t, slice_t str) {
+  if (str.size == 0) return str;
+  if (intern_grow(t)) return (slice_t){ 0 };
+
+  uint64_t hash = slice_hash(&str);
+  size_t i = intern_slot(t->items, t->capacity, hash, str);
+  if (t->items[i].str.data != NULL) {
+    t->saved += str.size;
+    return t->items[i].str;
+  }
+
+  char* data = arena_alloc(t->arena, str.size);
+  if (!data) return (slice_t){ 0 };
+  memcpy(data, str.data, str.size);
+
+  t->items[i] = (intern_entry_t){ .hash = hash, .str = { .data = data, .size = str.size } };
+  t->count++;
+  return t->items[i].str;
+}
+
+void intern_free(intern_table_t* t) {
+  free(t->items);
+  t->items = NULL;
+  t->count = 0;
+  t->capacity = 0;
+}
@@ -0,0 +1,45 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "slice.h"
+
+typedef struct {
+  uint64_t hash;
+  slice_t str;
+} intern_entry_t;
+
+/*
+ * Open addressing hash set of strings stored in an arena. Interning
+ * the same bytes twice returns the same slice, so interned strings
+ * can be compared by pointer.
+ */
+typedef struct {
+  arena_t* arena;
+  // empty slots have str.data == NULL
+  intern_entry_t* items;
+  size_t count;
+  // power of two, or 0
+  size_t capacity;
+  // bytes not copied because the string was already there
+  size_t saved;
+} intern_table_t;
+
+/*
+ * Returns the copy of str held by the table, copying it to the arena
+ * the first time it is seen.
+ * @param t pointer to intern_table_t structure, with its arena set
+ * @param str bytes to intern, not NUL terminated
+ * @return the interned string, an empty slice if out of memory.
+ */
+slice_t intern(intern_table_t* t, slice_t str);
+/*
+ * Frees the table, the strings stay in the arena.
+ * @param t pointer to intern_table_t structure
+ */
+void intern_free(intern_table_t* t);
+
+#endif // INTERN_H
@@ -36,40 +36,35 @@
 #include "logging.h"
 #include "timestamp.h"
 #include "slice.h"
+#include "ics.h"
+#include "thread.h"
+#include "fmap.h"
+#include "store.h"
 
 #define TODAY_DIR ".today"
 #define MAX_USRDIR_PATH 260
+// downloads run at the same time by --refresh, unless -j is given
+#define REFRESH_JOBS 8
 
+// Validators of a feed (RFC 9110, 8.8). When set they are sent back
+// to ask the server whether the feed changed since it was saved, they
+// are replaced by the ones of the response. Empty strings if unknown,
+// values that don't fit are dropped.
 typedef struct {
-  size_t dtstamp;
-  const char* uid;
-  timestamp_t dtstart;
-  timestamp_t dtend;
-  const char* cat;
-  const char* summary;
-  const char* location;
-  const char* geo;
-  const char* cal_name;
-} event_t;
-
-typedef struct {
-  event_t *items;
-  size_t count;
-  size_t capacity;
-} eventarr_t;
-
-typedef struct {
-  // const char* version;
-  const char* name;
-  eventarr_t events;
-} calendar_t;
-
-typedef enum {
-  STATE_UNDEF = 0,
-  STATE_CAL,
-  STATE_EVENT,
-  STATE_OTHER,
-} parse_state_t;
+  char etag[256];
+  char last_modified[64];
+  // set when the server answered 304 Not Modified, nothing was read
+  int not_modified;
+} http_cache_t;
+
+static void http_cache_set(char* dst, size_t size, const slice_t* value) {
+  if (value->size >= size) {
+    *dst = '\0';
+    return;
+  }
+  memcpy(dst, value->data, value->size);
+  dst[value->size] = '\0';
+}
 
 #ifdef _WIN32
 CHAR *helper_win32_error_message(DWORD err) {
@@ -124,140 +119,189 @@ char* get_full_path(arena_t* arena, const char* filename) {
 }
 
 
-int parse_calendar(arena_t* arena, sb_t* cal, const char* filename, calendar_t* calendar) {
-  slicearr_t lines = { 0 };
+#ifndef _WIN32
+typedef struct {
+  int sockfd;
+  SSL_CTX* ctx;
+  // NULL over plain HTTP
+  SSL* ssl;
+} http_conn_t;
+
+// Connects to host, over TLS if schema is 1. Whatever was set up is
+// released by http_close, even if it fails.
+static int http_connect(http_conn_t* conn, const char* host, int schema) {
+  // getaddrinfo is reentrant, feeds are fetched from several threads
+  struct addrinfo hints = { 0 };
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo* addrs = NULL;
+  int gai = getaddrinfo(host, schema ? "443" : "80", &hints, &addrs);
+  if (gai != 0) {
+    LOG_ERROR("Failed to resolve host `%s`: %s.", host, gai_strerror(gai));
+    return 1;
+  }
 
-  slice_t cal_slice = { .data = cal->items, .size = cal->count };
-  split(&cal_slice, "\n", 0, &lines);
+  for (struct addrinfo* ai = addrs; ai != NULL; ai = ai->ai_next) {
+    conn->sockfd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (conn->sockfd == -1) continue;
+    if (connect(conn->sockfd, ai->ai_addr, ai->ai_addrlen) == 0) break;
+    close(conn->sockfd);
+    conn->sockfd = -1;
+  }
+  freeaddrinfo(addrs);
+  if (conn->sockfd == -1) {
+    LOG_ERROR("Failed to connect to `%s`.", host);
+    return 1;
+  }
 
-  event_t e = { 0 };
-  parse_state_t state = STATE_UNDEF;
+  if (schema) {
+    conn->ctx = SSL_CTX_new(TLS_method());
+    if (!conn->ctx) return 1;
+    conn->ssl = SSL_new(conn->ctx);
+    if (!conn->ssl) return 1;
+    if (!SSL_set_tlsext_host_name(conn->ssl, host)) return 1;
+    if (!SSL_set_fd(conn->ssl, conn->sockfd)) return 1;
+    if (SSL_connect(conn->ssl) != 1) {
+      LOG_ERROR("TLS handshake with `%s` failed.", host);
+      return 1;
+    }
+  }
+  return 0;
+}
 
-  slicearr_t key_value = { 0 };
+static long http_send(http_conn_t* conn, const char* data, size_t size) {
+  if (conn->ssl) return SSL_write(conn->ssl, data, (int)size);
+  return send(conn->sockfd, data, size, 0);
+}
 
-  for (size_t i = 0; i < lines.count; i++, key_value.count = 0) {
-    slice_trim(&lines.items[i]);
+static long http_recv(http_conn_t* conn, char* buffer, size_t size) {
+  if (conn->ssl) return SSL_read(conn->ssl, buffer, (int)size);
+  return recv(conn->sockfd, buffer, size, 0);
+}
 
-    split(lines.items + i, ":", 1, &key_value);
-    slice_t key = key_value.items[0];
-    slice_t value = key_value.items[1];
-
-    if (slice_eq(&key, "X-WR-CALNAME")) {
-      calendar->name = arena_sprintf(arena, "%.*s", SLICE_FMT(value));
-    } else if (slice_eq(&key, "BEGIN")) {
-      if (slice_eq(&value, "VEVENT")) {
-        // LOG_DEBUG("BEGIN:VEVENT");
-        if (state == STATE_EVENT) {
-          LOG_ERROR("%s:%zu: Unclosed event", filename, i + 1);
-          return -1;
-        }
-        state = STATE_EVENT;
-      } else if (slice_eq(&value, "VCALENDAR")) {
-        if (state != STATE_UNDEF) {
-          LOG_ERROR("%s:%zu: Unexpected start of calendar", filename, i + 1);
-          return -1;
-        }
-        state = STATE_CAL;
-      }else {
-        state = STATE_OTHER;
-      }
-    } else if (slice_eq(&key, "END")) {
-      if (slice_eq(&value, "VEVENT")) {
-        // LOG_DEBUG("END:VEVENT");
-        if (state != STATE_EVENT) {
-          LOG_ERROR("%s:%zu: Closing event before BEGIN:VEVENT", filename, i + 1);
-          return -1;
-        }
-        e.cal_name = calendar->name;
-        da_append(&calendar->events, e); // copies
-        memset(&e, 0, sizeof(e));
-      } else if (slice_eq(&value, "VCALENDAR")) {
-        if (state != STATE_CAL) {
-          LOG_ERROR("%s:%zu: Unexpected end of calendar", filename, i + 1);
-          return -1;
-        }
-        return 0;
-      }
+static void http_close(http_conn_t* conn) {
+  if (conn->ssl) {
+    SSL_shutdown(conn->ssl);
+    SSL_free(conn->ssl);
+  }
+  if (conn->ctx) SSL_CTX_free(conn->ctx);
+  if (conn->sockfd != -1) close(conn->sockfd);
+  *conn = (http_conn_t){ .sockfd = -1 };
+}
 
-      state = STATE_CAL;
-    } else if (slice_eq(&key, "SUMMARY")) {
-      // LOG_DEBUG("SUMMARY");
-      if (state != STATE_EVENT) {
-        LOG_ERROR("%s:%zu: Summary outside of event.", filename, i + 1);
-        return -1;
-      }
-      e.summary = arena_sprintf(arena, "%.*s", SLICE_FMT(value));
-    } else if (slice_eq(&key, "DTSTART")) {
-      // LOG_DEBUG("SUMMARY");
-      if (state == STATE_OTHER) continue;
-      if (state != STATE_EVENT) {
-        LOG_ERROR("%s:%zu: Start time outside of event.", filename, i + 1);
-        return -1;
-      }
-      e.dtstart = (timestamp_t){
-        .y  = sized_atoi(value.data,      4),
-        .m  = sized_atoi(value.data + 4,  2),
-        .d  = sized_atoi(value.data + 6,  2),
-        .hh = sized_atoi(value.data + 9,  2),
-        .mm = sized_atoi(value.data + 11, 2),
-        .ss = sized_atoi(value.data + 13, 2),
-      };
-    } else if (slice_eq(&key, "DTEND")) {
-      // LOG_DEBUG("SUMMARY");
-      if (state == STATE_OTHER) continue;
-      if (state != STATE_EVENT) {
-        LOG_ERROR("%s:%zu: End time outside of event.", filename, i + 1);
-        return -1;
-      }
-      e.dtend = (timestamp_t){
-        .y  = sized_atoi(value.data,      4),
-        .m  = sized_atoi(value.data + 4,  2),
-        .d  = sized_atoi(value.data + 6,  2),
-        .hh = sized_atoi(value.data + 9,  2),
-        .mm = sized_atoi(value.data + 11, 2),
-        .ss = sized_atoi(value.data + 13, 2),
-      };
-    }
+// Sends req and reads the response, see http_get.
+// @param headers buffer for the response headers, freed by the caller
+static int http_exchange(http_conn_t* conn, const char* req, sb_t* headers, sb_t* out, ics_parser_t* parser, http_cache_t* cache) {
+  char buffer[4096];
+
+  if (http_send(conn, req, strlen(req)) < 0) return 1;
+
+  // parse headers
+  size_t headers_length = 0;
+  long n = 0;
+  for (;;) {
+    n = http_recv(conn, buffer, sizeof(buffer));
+    if (n <= 0) break;
+
+    // the terminator may be split between two reads
+    size_t from = headers->count > 3 ? headers->count - 3 : 0;
+    sb_n_append(headers, (const char*)buffer, n);
+
+    slice_t h = { .data = headers->items, .size = headers->count };
+    headers_length = slice_find(&h, from, "\r\n\r\n", 4);
+    if (headers_length < headers->count) break;
   }
 
-  return 0;
-}
+  if (n <= 0) {
+    LOG_ERROR("Connection closed before the end of the headers");
+    return 1;
+  }
 
-char* get_cal_name(arena_t* arena, sb_t* cal) {
-  char* name = NULL;
-  slicearr_t lines = { 0 };
+  // whatever follows the headers is the beginning of the body
+  const char* body = headers->items + headers_length + 4;
+  size_t body_length = headers->count - headers_length - 4;
+  headers->count = headers_length;
 
-  slice_t cal_slice = { .data = cal->items, .size = cal->count };
-  split(&cal_slice, "\n", 0, &lines);
+  int content_length = 0;
 
-  slicearr_t key_value = { 0 };
+  slicearr_t h_lines = { 0 };
+  slice_t h_slice = { .data = headers->items, .size = headers->count };
+  split(&h_slice, "\r\n", 0, &h_lines);
 
-  for (size_t i = 0; i < lines.count; i++, key_value.count = 0) {
-    slice_trim(&lines.items[i]);
+  slicearr_t status_line = { 0 };
+  split(&h_lines.items[0], " ", 2, &status_line);
+  if (status_line.count < 3) return 1;
 
-    split(lines.items + i, ":", 1, &key_value);
-    slice_t key = key_value.items[0];
-    slice_t value = key_value.items[1];
+  int status = slice_atoi(&status_line.items[1]);
+  slice_t msg = status_line.items[2];
 
-    if (slice_eq(&key, "X-WR-CALNAME")) {
-      name = arena_sprintf(arena, "%.*s", SLICE_FMT(value));
-      break;
+  if (status == 304 && cache) {
+    cache->not_modified = 1;
+    return 0;
+  }
+
+  if (status != 200) {
+    LOG_ERROR("HTTP request returned: %d %.*s", status, SLICE_FMT(msg));
+    return 1;
+  }
+
+  // validators of this response, kept only once the whole body is read
+  http_cache_t fresh = { 0 };
+
+  for(size_t i = 1; i < h_lines.count; i++) { 
+    slice_t* l = h_lines.items + i;
+
+    slice_trim(l);
+    slicearr_t kv_pair = { 0 };
+    split(l, ":", 1, &kv_pair);
+
+    if (kv_pair.count < 2) continue;
+  
+    slice_trim(&kv_pair.items[0]);
+    slice_trim(&kv_pair.items[1]);
+
+    // field names are case-insensitive
+    slice_t* name = &kv_pair.items[0];
+    if (slice_eq_nocase(name, "Content-Length")) {
+      content_length = slice_atoi(&kv_pair.items[1]);
+    } else if (slice_eq_nocase(name, "ETag")) {
+      http_cache_set(fresh.etag, sizeof(fresh.etag), &kv_pair.items[1]);
+    } else if (slice_eq_nocase(name, "Last-Modified")) {
+      http_cache_set(fresh.last_modified, sizeof(fresh.last_modified), &kv_pair.items[1]);
     }
   }
 
-  return name;
-}
+  if (content_length == 0) {
+    LOG_ERROR("Could not read body");
+    return 1;
+  }
 
-int qsort_event_cmp(const void* e1, const void* e2) {
-#ifdef _WIN32
-  // FIXME: shouldn't invert
-  return (int)-timestamp_cmp(((event_t*)e1)->dtstart, ((event_t*)e2)->dtstart);
-#else
-  return (int) timestamp_cmp(((event_t*)e1)->dtstart, ((event_t*)e2)->dtstart);
-#endif
+  if(out) sb_n_append(out, body, body_length);
+  if(parser) ics_parser_feed(parser, body, body_length);
+
+  size_t to_read = content_length > (int)body_length ? content_length - body_length : 0;
+  while(to_read > 0) {
+    n = http_recv(conn, buffer, sizeof(buffer));
+    if (n <= 0) break;
+
+    if(out) sb_n_append(out, buffer, n);
+    if(parser) ics_parser_feed(parser, buffer, n);
+
+    to_read = to_read > (size_t)n ? to_read - n : 0;
+  }
+
+  if (to_read > 0) {
+    LOG_ERROR("Connection closed before the end of the body");
+    return 1;
+  }
+
+  // validators the response doesn't send are forgotten
+  if (cache) *cache = fresh;
+  return 0;
 }
+#endif
 
-int http_get(slice_t* url, sb_t* out) {
+int http_get(slice_t* url, sb_t* out, ics_parser_t* parser, http_cache_t* cache) {
   arena_t arena = { 0 };
     
   if(out) out->count = 0;
@@ -282,9 +326,18 @@ int http_get(slice_t* url, sb_t* out) {
 
   const char* agent = "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/141.0.0.0 Safari/537.36";
 
-  char buffer[4096];
+  // conditional request, if we have the validators of a previous response
+  const char* conditions = "";
+  if (cache) {
+    cache->not_modified = 0;
+    conditions = arena_sprintf(&arena, "%s%s%s%s%s%s",
+      cache->etag[0] ? "If-None-Match: " : "", cache->etag, cache->etag[0] ? "\r\n" : "",
+      cache->last_modified[0] ? "If-Modified-Since: " : "", cache->last_modified, cache->last_modified[0] ? "\r\n" : "");
+  }
 
 #ifdef _WIN32
+  char buffer[4096];
+
   // TODO: support HTTPS
   if (schema != 0) {
     LOG_ERROR("HTTPS not supported yet, falling back to HTTP");
@@ -336,13 +389,30 @@ int http_get(slice_t* url, sb_t* out) {
 
   BOOL res = HttpSendRequestA(
     hRequest,
-    NULL,
+    *conditions ? conditions : NULL,
     (DWORD)-1,
     NULL,
     0
   );
   if (!res) return 1;
 
+  DWORD dwStatus = 0;
+  DWORD dwSize = sizeof(dwStatus);
+  if (!HttpQueryInfoA(hRequest, HTTP_QUERY_STATUS_CODE | HTTP_QUERY_FLAG_NUMBER, &dwStatus, &dwSize, NULL)) return 1;
+
+  if (dwStatus == HTTP_STATUS_NOT_MODIFIED && cache) {
+    cache->not_modified = 1;
+    InternetCloseHandle(hRequest);
+    InternetCloseHandle(hConnect);
+    InternetCloseHandle(hInternet);
+    arena_free(&arena);
+    return 0;
+  }
+  if (dwStatus != HTTP_STATUS_OK) {
+    LOG_ERROR("HTTP request returned: %lu", dwStatus);
+    return 1;
+  }
+
   DWORD dwRead = 0;
   do {
     dwRead = 0;
@@ -355,51 +425,22 @@ int http_get(slice_t* url, sb_t* out) {
     if (!res) return 1;
 
     if(out) sb_n_append(out, (const char*)buffer, dwRead);
+    if(parser) ics_parser_feed(parser, (const char*)buffer, dwRead);
     // LOG_INFO("extended output to %zu bytes (%lu read).", out->count, dwRead);
   } while (res && dwRead > 0);
 
+  // a body cut short fails the read above, the validators are kept only now
+  if (cache) {
+    dwSize = sizeof(cache->etag);
+    if (!HttpQueryInfoA(hRequest, HTTP_QUERY_ETAG, cache->etag, &dwSize, NULL)) cache->etag[0] = '\0';
+    dwSize = sizeof(cache->last_modified);
+    if (!HttpQueryInfoA(hRequest, HTTP_QUERY_LAST_MODIFIED, cache->last_modified, &dwSize, NULL)) cache->last_modified[0] = '\0';
+  }
+
 #else
   char* host = arena_sprintf(&arena, "%.*s", SLICE_FMT(url_structure.items[0]));
   char* obj = arena_sprintf(&arena, "%.*s", SLICE_FMT(url_structure.items[1]));
 
-  struct sockaddr_in servaddr = { 0 };
-  
-  int sockfd = socket(AF_INET, SOCK_STREAM, 0);
-  if (sockfd == -1) return 1; 
-
-  int pton_result = inet_pton(AF_INET, host, &servaddr.sin_addr);
-
-  if (pton_result == 0) {
-    struct hostent *server = gethostbyname(host);
-    if (server == NULL) {
-      close(sockfd);
-      LOG_ERROR("Failed to resolve host `%s`.", host);
-      return 1; 
-    }
-    memcpy(&servaddr.sin_addr.s_addr, server->h_addr_list[0], server->h_length);
-  }
-
-  servaddr.sin_family = AF_INET;
-  servaddr.sin_port = htons(schema ? 443 : 80);
-
-  if (connect(sockfd, (const struct sockaddr *)&servaddr, sizeof(servaddr))) return 1;
-  SSL* ssl = NULL;
-  if (schema) {
-    SSL_CTX* ctx = SSL_CTX_new(TLS_method());
-    if (!ctx) return 1;
-    ssl = SSL_new(ctx);
-    if (!ssl) { SSL_CTX_free(ctx); return 1;}
-
-    if (!SSL_set_tlsext_host_name(ssl, host)) {
-      SSL_free(ssl);
-      SSL_CTX_free(ctx);
-      return 1;
-    }
-
-    if (!SSL_set_fd(ssl, sockfd)) return 1;
-    if (!SSL_connect(ssl)) return 1;
-  }
-
   const char* req_fmt = 
     "GET /%s HTTP/1.1\r\n"
     "Host: %s\r\n"
@@ -408,114 +449,160 @@ int http_get(slice_t* url, sb_t* out) {
     "Cache-Control: no-cache\r\n"
     "Pragma: no-cache\r\n"
     "Connection: close\r\n"
+    "%s"
     "\r\n";
 
-  const char* req = arena_sprintf(&arena, req_fmt, obj, host, agent);
+  const char* req = arena_sprintf(&arena, req_fmt, obj, host, agent, conditions);
 
-  switch (schema){
-    case 0:
-      if(send(sockfd, req, strlen(req), 0) < 0) return 1;
-      break;
-    case 1:
-      if(SSL_write(ssl, req, strlen(req)) < 0) return 1;
-      break;
-  }
-
-  // parse headers
+  // every exit of the exchange goes through http_close
+  http_conn_t conn = { .sockfd = -1 };
   sb_t headers = { 0 };
-  char* terminator = NULL;
-  size_t headers_length = 0;
-  size_t n = 0;
-  do {
-    switch (schema){
-      case 0:
-        n = recv(sockfd, buffer, sizeof(buffer), 0);
-        break;
-      case 1:
-        n = SSL_read(ssl, buffer, sizeof(buffer));
-        break;
-    }
-    if (n <= 0) break;
-
-    terminator = strstr(buffer, "\r\n\r\n");
-    if (terminator) {
-      headers_length = (uintptr_t)terminator - (uintptr_t)buffer;
-      sb_n_append(&headers, (const char*)buffer, headers_length);
-    } else 
-      sb_n_append(&headers, (const char*)buffer, n);
-  } while (terminator == NULL);
-
-  int content_length = 0;
+  int failed = http_connect(&conn, host, schema) || http_exchange(&conn, req, &headers, out, parser, cache);
+  http_close(&conn);
+  sb_free(&headers);
+  if (failed) {
+    arena_free(&arena);
+    return 1;
+  }
+#endif
 
-  slicearr_t h_lines = { 0 };
-  slice_t h_slice = { .data = headers.items, .size = headers.size };
-  split(&h_slice, "\r\n", 0, &h_lines);
+  arena_free(&arena);
 
-  slicearr_t status_line = { 0 };
-  split(&h_lines.items[0], " ", 2, &status_line);
-  if (status_line.count < 3) return 1;
+  return 0;
+}
 
-  int status = slice_atoi(&status_line.items[1]);
-  slice_t msg = status_line.items[2];
+typedef struct {
+  fmap_t* items;
+  size_t count;
+  size_t capacity;
+} fmaparr_t;
 
-  if (status != 200) {
-    LOG_ERROR("HTTP request returned: %d %.*s", status, SLICE_FMT(msg));
-    return 1;
+typedef struct {
+  const slice_t* urls;
+  calendar_t* calendars;
+  // file each feed is saved to, named after its URL
+  const char** paths;
+  // whether the file holds the feed, fetched now or not modified
+  int* saved;
+  int* parsed;
+  // validators of each feed, from and for cache_path
+  http_cache_t* caches;
+  // saved calendars parsed in place when they didn't change
+  fmap_t* maps;
+  // one per worker
+  arena_t* arenas;
+  intern_table_t* strings;
+  const ics_window_t* window;
+} refresh_ctx_t;
+
+void refresh_calendar(void* ctx, size_t job, size_t worker) {
+  refresh_ctx_t* rc = ctx;
+  arena_t* arena = rc->arenas + worker;
+  const slice_t* url = rc->urls + job;
+  const char* path = rc->paths[job];
+  http_cache_t* cache = rc->caches + job;
+  fmap_t* saved = rc->maps + job;
+
+  // validators are only worth sending if the file they describe is still there
+  int have_saved = (cache->etag[0] || cache->last_modified[0])
+    && fmap_open(path, saved) > 0 && saved->view.data != NULL;
+  if (!have_saved) {
+    fmap_close(saved);
+    cache->etag[0] = '\0';
+    cache->last_modified[0] = '\0';
   }
 
-  for(size_t i = 1; i < h_lines.count; i++) { 
-    slice_t* l = h_lines.items + i;
+  LOG_INFO("Fetching %.*s", SLICE_FMT(*url));
+
+  // the body is parsed while it is downloaded
+  sb_t body = { 0 };
+  calendar_t* parsed = rc->calendars + job;
+  ics_parser_t parser = { 0 };
+  ics_parser_init(&parser, arena, arena_sprintf(arena, "%.*s", SLICE_FMT(*url)), parsed);
+  parser.window = rc->window;
+  parser.strings = rc->strings + worker;
+
+  slice_t u = *url;
+  int get_failed = http_get(&u, &body, &parser, cache);
+  int parse_failed = ics_parser_finish(&parser);
+  if (!get_failed && cache->not_modified && have_saved) {
+    // parsed in place, like the calendars loaded without --refresh
+    LOG_DEBUG("%.*s not modified, reading %s.", SLICE_FMT(*url), path);
+    sb_free(&body);
+    rc->saved[job] = 1;
+    if (parse_calendar(arena, &saved->view, path, parsed, rc->window, 1)) {
+      LOG_ERROR("Failed to parse calendar %s.", path);
+    } else {
+      rc->parsed[job] = 1;
+    }
+    return;
+  }
+  // the file is about to be rewritten
+  fmap_close(saved);
 
-    slice_trim(l);
-    slicearr_t kv_pair = { 0 };
-    split(l, ":", 1, &kv_pair);
+  if (get_failed || cache->not_modified) {
+    LOG_ERROR("HTTP GET `%.*s` failed", SLICE_FMT(*url));
+    sb_free(&body);
+    return;
+  }
 
-    if (kv_pair.count < 2) continue;
-  
-    slice_trim(&kv_pair.items[0]);
-    slice_trim(&kv_pair.items[1]);
+  if (parsed->name.size == 0) {
+    LOG_WARN("Could not find name for `%.*s`", SLICE_FMT(*url));
+  }
 
-    if(slice_eq(&kv_pair.items[0], "Content-Length"))
-      content_length = slice_atoi(&kv_pair.items[1]);
+  if (parse_failed) {
+    LOG_ERROR("Failed to parse calendar %s.", path);
+  } else {
+    rc->parsed[job] = 1;
   }
 
-  if (content_length == 0) {
-    LOG_ERROR("Could not read body");
-    return 1;
+  if (sb_write_to_file(path, &body) < 0) {
+    LOG_ERROR("Failed to write to file `%s`.", path);
+  } else {
+    rc->saved[job] = 1;
   }
+  sb_free(&body);
+}
 
-  if(out)
-    sb_n_append(out, buffer + (headers_length % sizeof(buffer)), sizeof(buffer) - (headers_length % sizeof(buffer)));
+// Reads the validators saved by the last refresh, one line per feed:
+//   url TAB path TAB etag TAB last-modified
+// Lines of files not named after their URL (older versions) are ignored.
+static void refresh_read_cache(const char* cache_path, const slicearr_t* feeds, refresh_ctx_t* rc) {
+  sb_t cache = { 0 };
+  if (sb_read_file(cache_path, &cache) < 0) return;
 
-  size_t to_read = content_length;
-  while(to_read > 0) {
-    switch (schema) {
-      case 0:
-        n = recv(sockfd, buffer, sizeof(buffer), 0);
-        break;
-      case 1:
-        n = SSL_read(ssl, buffer, sizeof(buffer));
-        break;
+  slice_t cache_slice = { .data = cache.items, .size = cache.count };
+  slicearr_t lines = { 0 };
+  split(&cache_slice, "\n", 0, &lines);
+
+  slicearr_t fields = { 0 };
+  da_foreach(slice_t, line, &lines) {
+    fields.count = 0;
+    split(line, "\t", 3, &fields);
+    if (fields.count < 4) continue;
+    for (size_t i = 0; i < feeds->count; i++) {
+      const slice_t* url = feeds->items + i;
+      if (url->size != fields.items[0].size || memcmp(url->data, fields.items[0].data, url->size) != 0) continue;
+      if (!slice_eq(&fields.items[1], rc->paths[i])) break;
+      http_cache_set(rc->caches[i].etag, sizeof(rc->caches[i].etag), &fields.items[2]);
+      http_cache_set(rc->caches[i].last_modified, sizeof(rc->caches[i].last_modified), &fields.items[3]);
+      break;
     }
-    if (n <= 0) break;
-
-    if(out)
-      sb_n_append(out, buffer, n);
-
-    to_read = to_read > n ? to_read - n : 0;
   }
-#endif
 
-  arena_free(&arena);
-
-  return 0;
+  da_free(fields);
+  da_free(lines);
+  sb_free(&cache);
 }
 
-int refresh(arena_t* arena, const char* cals_path, const char* urls_path) {
+// Downloads the calendars listed in urls_path, `jobs` at a time, and
+// lists the files they are saved to in cals_path. Calendars that didn't
+// change since the last refresh are read from their files, which stay
+// mapped in `sources`.
+int refresh(arena_t* arena, const char* cals_path, const char* urls_path, const char* cache_path, const ics_window_t* window, calendararr_t* calendars, fmaparr_t* sources, size_t jobs) {
   sb_t urls = { 0 };
   sb_t cals = { 0 };
-
-  sb_t calendar = { 0 };
+  sb_t cache = { 0 };
 
   if(sb_read_file(urls_path, &urls) < 0) {
     LOG_ERROR("Failed to read file `%s`", urls_path);
@@ -526,42 +613,115 @@ int refresh(arena_t* arena, const char* cals_path, const char* urls_path) {
   slicearr_t lines = { 0 };
   split(&cal_slice, "\n", 0, &lines);
 
+  slicearr_t feeds = { 0 };
   for (size_t i = 0; i < lines.count; i++) {
-    if (lines.items[i].size == 0) continue;
     slice_trim(&lines.items[i]);
+    if (lines.items[i].size == 0) continue;
+    // a repeated URL would have two jobs writing the file the other one maps
+    int seen = 0;
+    da_foreach(slice_t, f, &feeds) {
+      if (f->size == lines.items[i].size && memcmp(f->data, lines.items[i].data, f->size) == 0) {
+        seen = 1;
+        break;
+      }
+    }
+    if (seen) {
+      LOG_WARN("Skipping repeated calendar `%.*s`", SLICE_FMT(lines.items[i]));
+      continue;
+    }
+    da_append(&feeds, lines.items[i]);
+  }
 
-    calendar.count = 0;
+  if (feeds.count > 0) {
+    size_t threads = jobs < feeds.count ? jobs : feeds.count;
+
+    refresh_ctx_t rc = {
+      .urls = feeds.items,
+      .calendars = calloc(feeds.count, sizeof(calendar_t)),
+      .paths = calloc(feeds.count, sizeof(const char*)),
+      .saved = calloc(feeds.count, sizeof(int)),
+      .parsed = calloc(feeds.count, sizeof(int)),
+      .caches = calloc(feeds.count, sizeof(http_cache_t)),
+      .maps = calloc(feeds.count, sizeof(fmap_t)),
+      .arenas = calloc(threads, sizeof(arena_t)),
+      .strings = calloc(threads, sizeof(intern_table_t)),
+      .window = window,
+    };
+    if (!rc.calendars || !rc.paths || !rc.saved || !rc.parsed || !rc.caches || !rc.maps || !rc.arenas || !rc.strings) {
+      LOG_ERROR("Out of memory");
+      return 1;
+    }
+    // text is shared by the events of the calendars fetched by the same worker
+    for (size_t i = 0; i < threads; i++) rc.strings[i].arena = rc.arenas + i;
 
-    slice_t url  = lines.items[i];
+    // feeds sharing an X-WR-CALNAME, or without one, must not share a file
+    for (size_t i = 0; i < feeds.count; i++) {
+      uint64_t h = slice_hash(&feeds.items[i]);
+      rc.paths[i] = get_full_path(arena, arena_sprintf(arena, "calendars" OS_SEP "%016llx.ics", (unsigned long long)h));
+    }
+    refresh_read_cache(cache_path, &feeds, &rc);
 
-    LOG_INFO("Fetching %.*s", SLICE_FMT(url));
+    parallel_for(feeds.count, threads, refresh_calendar, &rc);
 
-    if(http_get(&url, &calendar)) {
-      LOG_ERROR("HTTP GET `%.*s` failed", SLICE_FMT(url));
-      continue;
+    size_t interned = 0;
+    size_t saved = 0;
+    for (size_t i = 0; i < threads; i++) {
+      interned += rc.strings[i].count;
+      saved += rc.strings[i].saved;
     }
-
-    char* cal_name = get_cal_name(arena, &calendar);
-    if (cal_name == NULL) {
-      LOG_WARN("Could not find name for `%.*s`", SLICE_FMT(url));
+    LOG_INFO("Interned %zu strings, %zu bytes saved.", interned, saved);
+    for (size_t i = 0; i < threads; i++) {
+      intern_free(rc.strings + i);
+      arena_splice(arena, rc.arenas + i);
     }
-    char* cal_path = get_full_path(arena, arena_sprintf(arena, "calendars" OS_SEP "%s.ics", cal_name)); 
-    sb_appendln(&cals, cal_path);
-    if (sb_write_to_file(cal_path, &calendar) < 0) {
-      LOG_ERROR("Failed to write to file `%s`.", cal_path);
-      continue;
+
+    // calendars keep the order of urls_path
+    for (size_t i = 0; i < feeds.count; i++) {
+      if (rc.maps[i].view.data) {
+        da_append(sources, rc.maps[i]);
+      }
+      if (rc.saved[i]) {
+        sb_appendln(&cals, rc.paths[i]);
+        http_cache_t* c = rc.caches + i;
+        sb_appendf(&cache, "%.*s\t%s\t%s\t%s\n", SLICE_FMT(feeds.items[i]), rc.paths[i], c->etag, c->last_modified);
+      }
+      if (rc.parsed[i]) {
+        da_append(calendars, rc.calendars[i]);
+      } else {
+        da_free(rc.calendars[i].events);
+        instance_set_free(&rc.calendars[i].exceptions);
+      }
     }
+
+    free(rc.calendars);
+    free(rc.paths);
+    free(rc.saved);
+    free(rc.parsed);
+    free(rc.caches);
+    free(rc.maps);
+    free(rc.arenas);
+    free(rc.strings);
+  }
+
+  da_free(feeds);
+  da_free(lines);
+
+  // without validators the next refresh just downloads everything
+  if (sb_write_to_file(cache_path, &cache) < 0) {
+    LOG_WARN("Failed to write to file `%s`.", cache_path);
   }
 
   if (sb_write_to_file(cals_path, &cals) < 0) {
     LOG_ERROR("Failed to write to file `%s`.", cals_path);
     sb_free(&urls);
     sb_free(&cals);
+    sb_free(&cache);
     return 1;
   }
 
   sb_free(&urls);
   sb_free(&cals);
+  sb_free(&cache);
 
   return 0;
 }
@@ -675,10 +835,11 @@ int delete_file(const char* filepath) {
   return 0;
 }
 
-int reset(const char* urls_fn, const char* cals_fn) {
+int reset(const char* urls_fn, const char* cals_fn, const char* cache_fn) {
   arena_t arena = { 0 };
   if(delete_file(urls_fn)) return 1;
   if(delete_file(cals_fn)) return 1;
+  if(delete_file(cache_fn)) return 1;
   // TODO: recursively delete .today/calendars
 
   arena_free(&arena);
@@ -686,6 +847,119 @@ int reset(const char* urls_fn, const char* cals_fn) {
   return 0;
 }
 
+typedef struct {
+  slice_t* files;
+  calendar_t* calendars;
+  // events point into the mapped files
+  fmap_t* maps;
+  int* loaded;
+  // one per worker
+  arena_t* arenas;
+  const ics_window_t* window;
+  size_t threads_per_file;
+} load_ctx_t;
+
+void load_calendar(void* ctx, size_t job, size_t worker) {
+  load_ctx_t* lc = ctx;
+  arena_t* arena = lc->arenas + worker;
+  slice_t* cal_fn = lc->files + job;
+
+  fmap_t* cal_file = lc->maps + job;
+
+  const char* calname = arena_sprintf(arena, "%.*s", SLICE_FMT(*cal_fn));
+  LOG_DEBUG("Reading file %s.", calname);
+  if(fmap_open(calname, cal_file) < 0) {
+    LOG_ERROR("Failed to read file `%s`.", calname); 
+    return;
+  }
+  if (cal_file->view.size == 0 || cal_file->view.data == NULL) {
+    LOG_ERROR("Failed to read file `%s`.", calname);
+    fmap_close(cal_file);
+    return;
+  }
+
+  calendar_t* calendar = lc->calendars + job;
+
+  if(parse_calendar(arena, &cal_file->view, calname, calendar, lc->window, lc->threads_per_file)) { 
+    LOG_ERROR("Failed to parse calendar %s.", calname);
+    fmap_close(cal_file);
+    return;
+  }
+
+  LOG_DEBUG("Calendar %.*s (%s), %zu total events.", SLICE_FMT(calendar->name), calname, calendar->events.count);
+  lc->loaded[job] = 1;
+}
+
+// Reads and parses the calendars listed in cals_path on up to `jobs` threads.
+// The files stay mapped in `sources` until the events are no longer needed.
+int load_calendars(arena_t* arena, const char* cals_path, const ics_window_t* window, calendararr_t* calendars, fmaparr_t* sources, size_t jobs) {
+  sb_t cals_fnames = { 0 };
+  if(sb_read_file(cals_path, &cals_fnames) < 0) {
+   LOG_ERROR("Failed to read file `%s`", cals_path); 
+   return 1;
+  }
+
+  slicearr_t lines = { 0 };
+  slice_t cals_fnames_slice = { .data = cals_fnames.items, .size = cals_fnames.count }; 
+  split(&cals_fnames_slice, "\n", 0, &lines);
+
+  slicearr_t cals = { 0 };
+  da_foreach(slice_t, cal_fn, &lines) {
+    if (!cal_fn->data || cal_fn->size == 0 || *cal_fn->data == '\0') continue;
+    da_append(&cals, *cal_fn);
+  }
+
+  if (cals.count > 0) {
+    size_t threads = jobs < cals.count ? jobs : cals.count;
+
+    load_ctx_t lc = {
+      .files = cals.items,
+      .calendars = calloc(cals.count, sizeof(calendar_t)),
+      .maps = calloc(cals.count, sizeof(fmap_t)),
+      .loaded = calloc(cals.count, sizeof(int)),
+      .arenas = calloc(threads, sizeof(arena_t)),
+      .window = window,
+      // threads left over go to the parser of each file
+      .threads_per_file = jobs / threads,
+    };
+    if (!lc.calendars || !lc.maps || !lc.loaded || !lc.arenas) {
+      LOG_ERROR("Out of memory");
+      return 1;
+    }
+
+    parallel_for(cals.count, threads, load_calendar, &lc);
+
+    for (size_t i = 0; i < threads; i++) arena_splice(arena, lc.arenas + i);
+    for (size_t i = 0; i < cals.count; i++) {
+      if (!lc.loaded[i]) continue;
+      da_append(calendars, lc.calendars[i]);
+      da_append(sources, lc.maps[i]);
+    }
+
+    free(lc.calendars);
+    free(lc.maps);
+    free(lc.loaded);
+    free(lc.arenas);
+  }
+
+  da_free(cals);
+  da_free(lines);
+  sb_free(&cals_fnames);
+
+  return 0;
+}
+
+// Local time of start, events that started before the day start at 00:00.
+timestamp_t day_start(int64_t start, const clock_snapshot_t* clock) {
+  return clock_local(clock, start > clock->day_start ? start : clock->day_start);
+}
+
+// Local time of end, events that end after the day end at 24:00.
+timestamp_t day_end(int64_t end, const clock_snapshot_t* clock) {
+  if (end >= clock->day_end) return (timestamp_t){ .hh = 24 };
+  return clock_local(clock, end);
+}
+
 #define shift(argc, argv) (argc-- > 0 ? *(argv++) : NULL);
 
 int main(int argc, char **argv) {
@@ -696,14 +970,16 @@ int main(int argc, char **argv) {
 
   const char* urls_fn = get_full_path(&arena, "urls");
   const char* cals_fn = get_full_path(&arena, "cals");
+  const char* cache_fn = get_full_path(&arena, "cache");
 
-  if (!urls_fn || !cals_fn) return 1;
+  if (!urls_fn || !cals_fn || !cache_fn) return 1;
 
   const char* program = shift(argc, argv);
   // fprintf(stderr, "%s\n", program);
   int f_help = 0;
   int f_refresh = 0;
   int f_reset = 0;
+  size_t f_jobs = 0;
   struct {
     int set;
     const char* url;
@@ -734,6 +1010,14 @@ int main(int argc, char **argv) {
       f_del.set = 1;
     } else if (strcmp(arg, "--refresh") == 0 || strcmp(arg, "-r") == 0) {
       f_refresh = 1;
+    } else if (strcmp(arg, "--jobs") == 0 || strcmp(arg, "-j") == 0) {
+      const char* jobs = shift(argc, argv);
+      int n = jobs ? atoi(jobs) : 0;
+      if (n <= 0) {
+        LOG_ERROR("Expected a positive <n> after --jobs option.");
+        return 1;
+      }
+      f_jobs = (size_t)n;
     } else if (strcmp(arg, "--reset") == 0) {
       f_reset = 1;
     } else {
@@ -752,6 +1036,8 @@ int main(int argc, char **argv) {
     fprintf(stdout, "\t--refresh  -r        Refreshes all the calendars.\n");
     fprintf(stdout, "\t--add      -a <url>  Adds <url> to the list of calendars.\n");
     fprintf(stdout, "\t--delete   -d <url>  Deletes <url> from the list of calendars.\n");
+    fprintf(stdout, "\t--jobs     -j <n>    Uses at most <n> threads (default: one per CPU,\n"
+                    "\t                     %d downloads with --refresh).\n", REFRESH_JOBS);
     fprintf(stdout, "\t--reset              Resets the application. You will lose all stored calendars.\n");
     return 0;
   }
@@ -764,7 +1050,7 @@ int main(int argc, char **argv) {
       switch(choice) {
         case 'y':
         case 'Y':
-          if(reset(urls_fn, cals_fn)) return 1;
+          if(reset(urls_fn, cals_fn, cache_fn)) return 1;
           brk = 1;
           break;
         case 'n':
@@ -783,107 +1069,94 @@ int main(int argc, char **argv) {
   if(create_file_if_not_exists(urls_fn)) return 1;
   if(create_file_if_not_exists(cals_fn)) return 1;
 
+  // only the events of today are parsed
+  clock_snapshot_t clock = { 0 };
+  clock_snapshot(&clock);
+  ics_window_t window = {
+    .start = clock.day_start,
+    .end   = clock.day_end,
+  };
+
+  // calendars fetched by refresh are parsed while they download
+  calendararr_t calendars = { 0 };
+  fmaparr_t sources = { 0 };
+  int refreshed = 0;
+
   if (f_add.set) {
     slice_t url = { (char*)f_add.url, strlen(f_add.url) };
-    if(http_get(&url, NULL)) {
+    if(http_get(&url, NULL, NULL, NULL)) {
       LOG_ERROR("Invalid URL");
       return 1;
     }
     if(add(f_add.url, urls_fn)) return 1;
-    // force refresh
-    if(refresh(&arena, cals_fn, urls_fn)) return 1;
   }
 
   if (f_del.set) {
     if(delete(f_del.url, urls_fn)) return 1;
   }
 
-  if (f_refresh) {
-    if(refresh(&arena, cals_fn, urls_fn)) return 1;
+  // adding forces a refresh, done once the deleted calendar is gone from the list
+  if (f_add.set || f_refresh) {
+    if(refresh(&arena, cals_fn, urls_fn, cache_fn, &window, &calendars, &sources, f_jobs ? f_jobs : REFRESH_JOBS)) return 1;
+    refreshed = 1;
   }
 
-  sb_t cals_fnames = { 0 };
-  if(sb_read_file(cals_fn, &cals_fnames) < 0) {
-   LOG_ERROR("Failed to read file `%s`", cals_fn); 
-   return 1;
+  if (!refreshed) {
+    if(load_calendars(&arena, cals_fn, &window, &calendars, &sources, f_jobs ? f_jobs : thread_count())) return 1;
   }
 
-  slicearr_t cals = { 0 };
-  slice_t cals_fnames_slice = { .data = cals_fnames.items, .size = cals_fnames.count }; 
-  split(&cals_fnames_slice, "\n", 0, &cals);
-
-  eventarr_t today = { 0 };
-
-  da_foreach(slice_t, cal_fn, &cals) {
-    if (!cal_fn->data || *cal_fn->data == '\0') continue;
-
-    sb_t cal_file = { 0 };
-
-    const char* calname = arena_sprintf(&arena, "%.*s", SLICE_FMT(*cal_fn));
-    LOG_DEBUG("Reading file %s.", calname);
-    if(sb_read_file(calname, &cal_file) < 0) {
-      LOG_ERROR("Failed to read file `%s`.", calname); 
-      continue;
-    }
-    if (cal_file.count == 0 || cal_file.items == NULL) {
-      LOG_ERROR("Failed to read file `%s`.", calname);
-      continue;
-    }
-
-    calendar_t calendar = { 0 };
-
-    if(parse_calendar(&arena, &cal_file, calname, &calendar)) { 
-      LOG_ERROR("Failed to parse calendar %s.", calname);
-      continue;
-    }
+  event_store_t store = { 0 };
+  if (event_store_build(&store, &calendars)) {
+    LOG_ERROR("Out of memory");
+    return 1;
+  }
 
-    LOG_DEBUG("Calendar %s (%s), %zu total events.", calendar.name, calname, calendar.events.count);
-    da_foreach(event_t, e, &calendar.events) {
-      if (
-        ( timestamp_cmp(e->dtstart, today_00()) > 0 &&
-          timestamp_cmp(e->dtstart, today_24()) < 0 ) ||
-        ( timestamp_cmp(e->dtend, today_00()) > 0 &&
-          timestamp_cmp(e->dtend, today_24()) < 0)
-      ) {
-        da_append(&today, *e);
-      }
-    }
+  // occurrences of today, sorted by start time
+  event_hits_t today = { 0 };
+  event_store_query(&store, window.start, window.end, &today);
+  size_t duplicates = event_store_dedup(&store, &today);
+  if (duplicates > 0) {
+    LOG_DEBUG("Dropped %zu duplicate events.", duplicates);
   }
 
   printf("Events for today, ");
-  timestamp_day_print(now());
+  timestamp_day_print(clock.local);
   printf(":\n");
 
-  if (!today.items || today.count == 0) {
+  if (today.count == 0) {
     printf("No events.\n");
     return 0;
   }
 
-  // TODO: handle events spanning multiple days
-  qsort(today.items, today.count, sizeof(*today.items), (int(*)(const void*, const void*))qsort_event_cmp);
   if (!arg || strcmp("list", format) == 0) {
-    da_foreach(event_t, e, &today) {
-      printf("[%02d:%02d - %02d:%02d] (%s) %s\n", e->dtstart.hh, e->dtstart.mm, e->dtend.hh, e->dtend.mm, e->cal_name, e->summary);
+    da_foreach(event_hit_t, hit, &today) {
+      const event_t* e = event_store_event(&store, hit);
+      timestamp_t start = day_start(hit->start, &clock);
+      timestamp_t end = day_end(hit->end, &clock);
+      printf("[%02d:%02d - %02d:%02d] (", start.hh, start.mm, end.hh, end.mm);
+      ics_print_text(stdout, e->cal_name);
+      printf(") ");
+      ics_print_text(stdout, e->summary);
+      printf("\n");
     }
   } else if (strcmp("table", format) == 0) {
 
-    event_t *first = today.items;
-    for (;; first++) {
-      if (timestamp_cmp(first->dtstart, today_00()) > 0) break;
+    // hits are sorted by start, the first one starts earliest
+    timestamp_t first_start = day_start(today.items[0].start, &clock);
+    size_t h_start = first_start.hh;
+    size_t h_end = h_start;
+    da_foreach(event_hit_t, hit, &today) {
+      timestamp_t end = day_end(hit->end, &clock);
+      size_t h = end.hh + (end.mm > 0);
+      if (h > h_end) h_end = h;
     }
-    event_t *last = today.items;
-    da_foreach(event_t, ev, &today) {
-      if (timestamp_cmp(today_24(), ev->dtend) > 0 && timestamp_cmp(ev->dtend, last->dtend) > 0) last = ev;
-    }
-
-    size_t h_start = first->dtstart.hh;
-    size_t h_end   = last->dtend.hh + (last->dtend.mm > 0);
+    if (h_end == h_start) h_end++;
 
     size_t h_diff = h_end - h_start;
     size_t space = 100 / h_diff;
 
-    timestamp_t n = now();
-    uint64_t now_h = (n.hh * space)   + (n.mm / (60 / space));
+    timestamp_t n = clock.local;
+    uint64_t now_h = (n.hh * space)   + (n.mm * space / 60);
 
     for (size_t i = h_start * space; i <= h_end * space; i++ ) {
       if (i == now_h) {
@@ -898,10 +1171,13 @@ int main(int argc, char **argv) {
     }
     printf("\n");
 
-    da_foreach(event_t, e, &today) {
+    da_foreach(event_hit_t, hit, &today) {
+      const event_t* e = event_store_event(&store, hit);
+      timestamp_t e_start = day_start(hit->start, &clock);
+      timestamp_t e_end = day_end(hit->end, &clock);
       for (size_t i = h_start * space; i <= h_end * space; i++ ) {
-        uint64_t start = (e->dtstart.hh * space) + (e->dtstart.mm / (60 / space));
-        uint64_t end   = (e->dtend.hh * space)   + (e->dtend.mm / (60 / space));
+        uint64_t start = (e_start.hh * space) + (e_start.mm * space / 60);
+        uint64_t end   = (e_end.hh * space)   + (e_end.mm * space / 60);
 
         if (i == now_h) {
           printf("|");
@@ -919,7 +1195,11 @@ int main(int argc, char **argv) {
           }
         }
       }
-      printf(" (%s) %s \n",e->cal_name, e->summary);
+      printf(" (");
+      ics_print_text(stdout, e->cal_name);
+      printf(") ");
+      ics_print_text(stdout, e->summary);
+      printf(" \n");
     }
 
     for (size_t i = h_start * space; i <= h_end * space; i++ ) {
@@ -935,6 +1215,10 @@ int main(int argc, char **argv) {
     }
   }
 
+  da_free(today);
+  event_store_free(&store);
+  da_foreach(fmap_t, m, &sources) fmap_close(m);
+  tz_cache_free();
   arena_free(&arena);
 
   return 0;
@@ -0,0 +1,389 @@
+#include "rrule.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "timestamp.h"
+
+// Periods in a row without occurrences before giving up on a rule
+// that can't match anything (BYMONTHDAY=30 on February, ...)
+#define RRULE_MAX_EMPTY 1000
+
+static int64_t floor_div(int64_t a, int64_t b) {
+  int64_t q = a / b;
+  return (a % b != 0 && (a < 0) != (b < 0)) ? q - 1 : q;
+}
+
+// 1970-01-01 was a Thursday
+static int weekday(int64_t day) {
+  return (int)(day - floor_div(day + 3, 7) * 7 + 3);
+}
+
+static int64_t civil_day(int y, int m, int d) {
+  return timestamp_to_epoch((timestamp_t){ .y = y, .m = m, .d = d }) / 86400;
+}
+
+static timestamp_t day_civil(int64_t day) {
+  return timestamp_from_epoch(day * 86400);
+}
+
+static int days_in_month(int y, int m) {
+  return m == 12 ? 31 : (int)(civil_day(y, m + 1, 1) - civil_day(y, m, 1));
+}
+
+static int bit_count(unsigned int x) {
+  int n = 0;
+  for (; x; x &= x - 1) n++;
+  return n;
+}
+
+static int parse_weekday(const char* s) {
+  static const char* names[] = { "MO", "TU", "WE", "TH", "FR", "SA", "SU" };
+  for (int i = 0; i < 7; i++) {
+    if (memcmp(s, names[i], 2) == 0) return i;
+  }
+  return -1;
+}
+
+static int parse_byday(slice_t list, rrule_t* r) {
+  slicearr_t items = { 0 };
+  split(&list, ",", 0, &items);
+
+  int res = 0;
+  for (size_t i = 0; i < items.count && res == 0; i++) {
+    slice_t item = items.items[i];
+    if (item.size < 2) { res = -1; break; }
+
+    int wd = parse_weekday(item.data + item.size - 2);
+    if (wd < 0) { res = -1; break; }
+
+    if (item.size == 2) {
+      r->byday |= 1u << wd;
+      continue;
+    }
+    const char* n = item.data;
+    size_t n_size = item.size - 2;
+    if (*n == '+') { n++; n_size--; }
+    int nth = sized_atoi(n, n_size);
+    if (nth == 0 || nth > 53 || nth < -53 || r->nth_count == RRULE_MAX_NTH) { res = -1; break; }
+    r->nth[r->nth_count].n = nth;
+    r->nth[r->nth_count].wd = wd;
+    r->nth_count++;
+  }
+
+  if (items.items) free(items.items);
+  return res;
+}
+
+static int parse_bymonthday(slice_t list, rrule_t* r) {
+  slicearr_t items = { 0 };
+  split(&list, ",", 0, &items);
+
+  int res = 0;
+  for (size_t i = 0; i < items.count; i++) {
+    slice_t item = items.items[i];
+    if (item.size > 0 && *item.data == '+') { item.data++; item.size--; }
+    int d = slice_atoi(&item);
+    if (d >= 1 && d <= 31) {
+      r->bymonthday |= 1u << (d - 1);
+    } else if (d <= -1 && d >= -31) {
+      r->bymonthday_neg |= 1u << (-d - 1);
+    } else {
+      res = -1;
+      break;
+    }
+  }
+
+  if (items.items) free(items.items);
+  return res;
+}
+
+int rrule_parse(slice_t value, rrule_t* r) {
+  memset(r, 0, sizeof(*r));
+  r->interval = 1;
+  r->until = TIMESTAMP_INVALID;
+
+  slicearr_t parts = { 0 };
+  split(&value, ";", 0, &parts);
+
+  int res = 0;
+  for (size_t i = 0; i < parts.count && res == 0; i++) {
+    slice_t part = parts.items[i];
+    size_t eq = slice_find(&part, 0, "=", 1);
+    if (eq >= part.size) {
+      res = part.size == 0 ? 0 : -1;
+      continue;
+    }
+    slice_t name = { .data = part.data, .size = eq };
+    slice_t val = { .data = part.data + eq + 1, .size = part.size - eq - 1 };
+
+    if (slice_eq(&name, "FREQ")) {
+      if (slice_eq(&val, "DAILY")) r->freq = RRULE_DAILY;
+      else if (slice_eq(&val, "WEEKLY")) r->freq = RRULE_WEEKLY;
+      else if (slice_eq(&val, "MONTHLY")) r->freq = RRULE_MONTHLY;
+      else if (slice_eq(&val, "YEARLY")) r->freq = RRULE_YEARLY;
+      else res = -1;
+    } else if (slice_eq(&name, "INTERVAL")) {
+      r->interval = slice_atoi(&val);
+      if (r->interval <= 0) res = -1;
+    } else if (slice_eq(&name, "COUNT")) {
+      r->count = slice_atoi(&val);
+      if (r->count <= 0) res = -1;
+    } else if (slice_eq(&name, "UNTIL")) {
+      r->until = timestamp_parse(val.data, val.size, &r->until_flags);
+      if (r->until == TIMESTAMP_INVALID) res = -1;
+    } else if (slice_eq(&name, "WKST")) {
+      r->wkst = val.size == 2 ? parse_weekday(val.data) : -1;
+      if (r->wkst < 0) res = -1;
+    } else if (slice_eq(&name, "BYDAY")) {
+      res = parse_byday(val, r);
+    } else if (slice_eq(&name, "BYMONTHDAY")) {
+      res = parse_bymonthday(val, r);
+    } else {
+      res = -1;
+    }
+  }
+
+  if (parts.items) free(parts.items);
+  if (r->freq == RRULE_NONE) res = -1;
+  return res;
+}
+
+void rrule_bind(rrule_t* r, int64_t dtstart, int utc, const tz_t* tz) {
+  r->dtstart = dtstart;
+
+  int64_t day = floor_div(dtstart, 86400);
+  timestamp_t start = day_civil(day);
+
+  // ordinals only make sense in months and years
+  if (r->freq == RRULE_WEEKLY || r->freq == RRULE_DAILY) {
+    for (size_t i = 0; i < r->nth_count; i++) r->byday |= 1u << r->nth[i].wd;
+    r->nth_count = 0;
+  }
+  if (r->freq == RRULE_WEEKLY && r->byday == 0) r->byday = 1u << weekday(day);
+  if (r->freq == RRULE_MONTHLY && !r->byday && !r->nth_count && !r->bymonthday && !r->bymonthday_neg) {
+    r->bymonthday = 1u << (start.d - 1);
+  }
+
+  if (r->until != TIMESTAMP_INVALID) {
+    // a date includes the whole day
+    if (r->until_flags & TIMESTAMP_DATE) r->until += 86400 - 1;
+    if ((r->until_flags & TIMESTAMP_UTC) && tz) {
+      r->until += tz_offset(tz, r->until);
+    } else if ((r->until_flags & TIMESTAMP_UTC) && !utc) {
+      r->until = timestamp_to_epoch(timestamp_utc_to_local(r->until));
+    } else if (!(r->until_flags & TIMESTAMP_UTC) && utc) {
+      r->until = timestamp_local_to_utc(r->until);
+    }
+  }
+}
+
+static int rrule_plain_yearly(const rrule_t* r) {
+  return r->freq == RRULE_YEARLY && !r->byday && !r->nth_count && !r->bymonthday && !r->bymonthday_neg;
+}
+
+// First and last day of period p. Yearly rules without BYxxx parts
+// only look at the anniversary, the range is empty when it doesn't exist.
+static void period_range(const rrule_t* r, int64_t p, int64_t* first, int64_t* last) {
+  int64_t day = floor_div(r->dtstart, 86400);
+  timestamp_t start = day_civil(day);
+
+  switch (r->freq) {
+    case RRULE_DAILY:
+      *first = *last = day + p * r->interval;
+      break;
+    case RRULE_WEEKLY: {
+      int64_t week = day - (weekday(day) - r->wkst + 7) % 7;
+      *first = week + 7 * p * r->interval;
+      *last = *first + 6;
+    } break;
+    case RRULE_MONTHLY: {
+      int64_t month = (int64_t)start.y * 12 + start.m - 1 + p * r->interval;
+      int y = (int)floor_div(month, 12);
+      int m = (int)(month - (int64_t)y * 12) + 1;
+      *first = civil_day(y, m, 1);
+      *last = *first + days_in_month(y, m) - 1;
+    } break;
+    case RRULE_YEARLY: {
+      int y = start.y + (int)(p * r->interval);
+      if (rrule_plain_yearly(r)) {
+        *first = civil_day(y, start.m, start.d);
+        *last = start.d <= days_in_month(y, start.m) ? *first : *first - 1;
+      } else {
+        *first = civil_day(y, 1, 1);
+        *last = civil_day(y + 1, 1, 1) - 1;
+      }
+    } break;
+    default:
+      *first = 0;
+      *last = -1;
+      break;
+  }
+}
+
+// Period holding `day`, or the one before it when periods have gaps
+static int64_t period_of(const rrule_t* r, int64_t day) {
+  int64_t start = floor_div(r->dtstart, 86400);
+  timestamp_t s = day_civil(start);
+  timestamp_t d = day_civil(day);
+
+  switch (r->freq) {
+    case RRULE_DAILY:
+      return floor_div(day - start, r->interval);
+    case RRULE_WEEKLY: {
+      int64_t week = start - (weekday(start) - r->wkst + 7) % 7;
+      return floor_div(day - week, 7 * (int64_t)r->interval);
+    }
+    case RRULE_MONTHLY:
+      return floor_div(((int64_t)d.y * 12 + d.m) - ((int64_t)s.y * 12 + s.m), r->interval);
+    case RRULE_YEARLY:
+      return floor_div(d.y - s.y, r->interval);
+    default:
+      return 0;
+  }
+}
+
+static int monthday_match(const rrule_t* r, timestamp_t t) {
+  if (r->bymonthday & (1u << (t.d - 1))) return 1;
+  int from_end = days_in_month(t.y, t.m) - t.d + 1;
+  return (r->bymonthday_neg & (1u << (from_end - 1))) != 0;
+}
+
+// Ordinals count the weekdays of the period [first, last]
+static int byday_match(const rrule_t* r, int64_t day, int64_t first, int64_t last) {
+  int wd = weekday(day);
+  if (r->byday & (1u << wd)) return 1;
+
+  for (size_t i = 0; i < r->nth_count; i++) {
+    if (r->nth[i].wd != wd) continue;
+    int n = r->nth[i].n;
+    if (n > 0 && (day - first) / 7 + 1 == n) return 1;
+    if (n < 0 && -((last - day) / 7 + 1) == n) return 1;
+  }
+  return 0;
+}
+
+static int day_match(const rrule_t* r, int64_t day, int64_t first, int64_t last) {
+  int has_byday = r->byday || r->nth_count;
+  int has_monthday = r->bymonthday || r->bymonthday_neg;
+
+  switch (r->freq) {
+    case RRULE_WEEKLY:
+      return (r->byday & (1u << weekday(day))) != 0;
+    case RRULE_YEARLY:
+      // the range is already the anniversary
+      if (rrule_plain_yearly(r)) return 1;
+      // fallthrough
+    case RRULE_DAILY:
+    case RRULE_MONTHLY:
+      if (has_monthday && !monthday_match(r, day_civil(day))) return 0;
+      if (has_byday && !byday_match(r, day, first, last)) return 0;
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+// Occurrences in period p, up to `cap`
+static int64_t period_count(const rrule_t* r, int64_t p, int64_t cap) {
+  int64_t first, last;
+  period_range(r, p, &first, &last);
+
+  int64_t tod = r->dtstart - floor_div(r->dtstart, 86400) * 86400;
+  int64_t n = 0;
+  for (int64_t day = first; day <= last && n < cap; day++) {
+    int64_t t = day * 86400 + tod;
+    if (t < r->dtstart || !day_match(r, day, first, last)) continue;
+    if (r->until != TIMESTAMP_INVALID && t > r->until) break;
+    n++;
+  }
+  return n;
+}
+
+// Occurrences in the periods before p, up to the COUNT of the rule
+static int64_t count_before(const rrule_t* r, int64_t p) {
+  int64_t cap = r->count;
+  if (p <= 0) return 0;
+
+  int has_monthday = r->bymonthday || r->bymonthday_neg;
+
+  // every period holds the same amount of occurrences but the first,
+  // which may start before DTSTART
+  if (r->freq == RRULE_DAILY && !has_monthday && !r->byday) return p < cap ? p : cap;
+  if (r->freq == RRULE_WEEKLY) {
+    int64_t n = period_count(r, 0, cap) + (p - 1) * bit_count(r->byday);
+    return n < cap ? n : cap;
+  }
+  // with BYDAY, days repeat their weekday every 7 periods
+  if (r->freq == RRULE_DAILY && !has_monthday) {
+    int64_t cycle = 0;
+    for (int64_t q = 0; q < 7; q++) cycle += period_count(r, q, 1);
+    int64_t n = (p / 7) * cycle;
+    for (int64_t q = 0; q < p % 7; q++) n += period_count(r, q, 1);
+    return n < cap ? n : cap;
+  }
+
+  int64_t n = 0;
+  for (int64_t q = 0; q < p && n < cap; q++) n += period_count(r, q, cap - n);
+  return n;
+}
+
+void rrule_iter_init(rrule_iter_t* it, const rrule_t* r, int64_t from) {
+  memset(it, 0, sizeof(*it));
+  it->rule = r;
+  it->from = from > r->dtstart ? from : r->dtstart;
+
+  if (r->freq == RRULE_NONE || (r->until != TIMESTAMP_INVALID && it->from > r->until)) {
+    it->done = 1;
+    return;
+  }
+
+  int64_t p = period_of(r, floor_div(it->from, 86400));
+  if (p < 0) p = 0;
+  if (r->count) {
+    it->index = count_before(r, p);
+    if (it->index >= r->count) {
+      it->done = 1;
+      return;
+    }
+  }
+
+  it->period = p;
+  period_range(r, p, &it->first_day, &it->last_day);
+  it->day = it->first_day;
+}
+
+int rrule_next(rrule_iter_t* it, int64_t* t) {
+  const rrule_t* r = it->rule;
+  int64_t tod = r->dtstart - floor_div(r->dtstart, 86400) * 86400;
+  int empty = 0;
+
+  while (!it->done) {
+    if (it->day > it->last_day) {
+      if (++empty > RRULE_MAX_EMPTY) it->done = 1;
+      it->period++;
+      period_range(r, it->period, &it->first_day, &it->last_day);
+      it->day = it->first_day;
+      continue;
+    }
+
+    int64_t day = it->day++;
+    if (!day_match(r, day, it->first_day, it->last_day)) continue;
+
+    int64_t occ = day * 86400 + tod;
+    if (occ < r->dtstart) continue;
+    if (r->until != TIMESTAMP_INVALID && occ > r->until) break;
+    if (r->count) {
+      if (it->index >= r->count) break;
+      it->index++;
+    }
+    empty = 0;
+    if (occ < it->from) continue;
+
+    *t = occ;
+    return 1;
+  }
+
+  it->done = 1;
+  return 0;
+}
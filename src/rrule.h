@@ -0,0 +1,98 @@
+#ifndef RRULE_H
+#define RRULE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "slice.h"
+#include "tz.h"
+
+typedef enum {
+  RRULE_NONE = 0,
+  RRULE_DAILY,
+  RRULE_WEEKLY,
+  RRULE_MONTHLY,
+  RRULE_YEARLY,
+} rrule_freq_t;
+
+// Weekdays with an ordinal, "-1FR" is the last Friday of the period
+#define RRULE_MAX_NTH 8
+
+/*
+ * Compiled recurrence rule. Days are counted since 1970-01-01 and
+ * weekdays go from 0 (Monday) to 6 (Sunday). Times are wall clock
+ * seconds, like DTSTART (see timestamp_parse).
+ */
+typedef struct {
+  rrule_freq_t freq;
+  int interval;
+  // 0 if unbounded
+  int count;
+  // last possible occurrence, TIMESTAMP_INVALID if unbounded
+  int64_t until;
+  int until_flags;
+  int wkst;
+  // BYDAY without ordinal, bit w for weekday w
+  unsigned int byday;
+  struct {
+    int n;
+    int wd;
+  } nth[RRULE_MAX_NTH];
+  size_t nth_count;
+  // BYMONTHDAY, bit d-1 for day d and for day -d
+  uint32_t bymonthday;
+  uint32_t bymonthday_neg;
+  // set by rrule_bind
+  int64_t dtstart;
+} rrule_t;
+
+/*
+ * Iterator over the occurrences of a rule, see rrule_iter_init.
+ */
+typedef struct {
+  const rrule_t* rule;
+  int64_t from;
+  // current period and the next day to look at in it
+  int64_t period;
+  int64_t day;
+  int64_t first_day;
+  int64_t last_day;
+  // occurrences since DTSTART, for COUNT
+  int64_t index;
+  int done;
+} rrule_iter_t;
+
+/*
+ * Parses the value of a RRULE property.
+ * @param value text of the rule, e.g. FREQ=WEEKLY;BYDAY=MO,WE
+ * @param r pointer to rrule_t structure that will hold the rule
+ * @return 0 on success, < 0 if the rule is malformed or uses parts
+ *         we can't expand (BYMONTH, BYSETPOS, HOURLY, ...).
+ */
+int rrule_parse(slice_t value, rrule_t* r);
+/*
+ * Anchors the rule to the start of the event, filling the parts
+ * RFC 5545 takes from DTSTART when they are missing.
+ * @param r pointer to a parsed rrule_t
+ * @param dtstart wall clock time of DTSTART
+ * @param utc whether DTSTART is in UTC, UNTIL is converted to match
+ * @param tz zone of DTSTART, NULL if it is in UTC or in local time
+ */
+void rrule_bind(rrule_t* r, int64_t dtstart, int utc, const tz_t* tz);
+/*
+ * Starts iterating at the first occurrence at or after `from`.
+ * The periods before it are jumped over, only COUNT may need to
+ * look at them.
+ * @param it pointer to rrule_iter_t structure
+ * @param r bound rule, must outlive the iterator
+ * @param from wall clock time
+ */
+void rrule_iter_init(rrule_iter_t* it, const rrule_t* r, int64_t from);
+/*
+ * @param it pointer to rrule_iter_t structure
+ * @param t set to the wall clock time of the next occurrence
+ * @return 1 if there is one, 0 when the rule is over.
+ */
+int rrule_next(rrule_iter_t* it, int64_t* t);
+
+#endif // RRULE_H
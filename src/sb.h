@@ -109,8 +109,6 @@ int sb_concat(sb_t* a, sb_t* b);
  */
 void sb_free(sb_t* sb);
 
-#endif
-
 #ifdef SB_IMPLEMENTATION
 
 size_t sb_reserve(sb_t *sb, size_t size) {
@@ -301,3 +299,4 @@ void sb_free(sb_t* sb) {
 }
 
 #endif
+#endif // SB_H
@@ -3,23 +3,199 @@
 #include <string.h>
 #include <ctype.h>
 
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#include "cpu.h"
 #include "da.h"
 
+typedef size_t (*find_fn_t)(const char* data, size_t size, const char* sep, size_t sep_len);
+typedef size_t (*count_fn_t)(const char* data, size_t size, char c);
+
+static size_t find_scalar(const char* data, size_t size, const char* sep, size_t sep_len) {
+  for (size_t i = 0; i + sep_len <= size; i++) {
+    if (data[i] == sep[0] && memcmp(data + i, sep, sep_len) == 0) return i;
+  }
+  return size;
+}
+
+static size_t count_scalar(const char* data, size_t size, char c) {
+  size_t n = 0;
+  for (size_t i = 0; i < size; i++) n += data[i] == c;
+  return n;
+}
+
+#ifdef CPU_X86_64
+// Candidates are found comparing the first two bytes of sep,
+// longer separators are then checked with memcmp.
+static size_t find_sse2(const char* data, size_t size, const char* sep, size_t sep_len) {
+  size_t i = 0;
+  __m128i c0 = _mm_set1_epi8(sep[0]);
+
+  if (sep_len == 1) {
+    for (; i + 16 <= size; i += 16) {
+      __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+      unsigned int m = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(v, c0));
+      if (m) return i + ctz32(m);
+    }
+  } else {
+    __m128i c1 = _mm_set1_epi8(sep[1]);
+    for (; i + 17 <= size; i += 16) {
+      __m128i v0 = _mm_loadu_si128((const __m128i*)(data + i));
+      __m128i v1 = _mm_loadu_si128((const __m128i*)(data + i + 1));
+      unsigned int m = (unsigned int)_mm_movemask_epi8(
+        _mm_and_si128(_mm_cmpeq_epi8(v0, c0), _mm_cmpeq_epi8(v1, c1))
+      );
+      while (m) {
+        size_t j = i + ctz32(m);
+        if (j + sep_len <= size && memcmp(data + j + 2, sep + 2, sep_len - 2) == 0) return j;
+        m &= m - 1;
+      }
+    }
+  }
+
+  return i + find_scalar(data + i, size - i, sep, sep_len);
+}
+
+TARGET_AVX2
+static size_t find_avx2(const char* data, size_t size, const char* sep, size_t sep_len) {
+  size_t i = 0;
+  __m256i c0 = _mm256_set1_epi8(sep[0]);
+
+  if (sep_len == 1) {
+    for (; i + 32 <= size; i += 32) {
+      __m256i v = _mm256_loadu_si256((const __m256i*)(data + i));
+      unsigned int m = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, c0));
+      if (m) return i + ctz32(m);
+    }
+  } else {
+    __m256i c1 = _mm256_set1_epi8(sep[1]);
+    for (; i + 33 <= size; i += 32) {
+      __m256i v0 = _mm256_loadu_si256((const __m256i*)(data + i));
+      __m256i v1 = _mm256_loadu_si256((const __m256i*)(data + i + 1));
+      unsigned int m = (unsigned int)_mm256_movemask_epi8(
+        _mm256_and_si256(_mm256_cmpeq_epi8(v0, c0), _mm256_cmpeq_epi8(v1, c1))
+      );
+      while (m) {
+        size_t j = i + ctz32(m);
+        if (j + sep_len <= size && memcmp(data + j + 2, sep + 2, sep_len - 2) == 0) return j;
+        m &= m - 1;
+      }
+    }
+  }
+
+  return i + find_scalar(data + i, size - i, sep, sep_len);
+}
+
+static size_t count_sse2(const char* data, size_t size, char c) {
+  size_t i = 0;
+  size_t n = 0;
+  __m128i c0 = _mm_set1_epi8(c);
+
+  for (; i + 16 <= size; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+    n += popcount32((unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(v, c0)));
+  }
+
+  return n + count_scalar(data + i, size - i, c);
+}
+
+TARGET_AVX2
+static size_t count_avx2(const char* data, size_t size, char c) {
+  size_t i = 0;
+  size_t n = 0;
+  __m256i c0 = _mm256_set1_epi8(c);
+
+  for (; i + 32 <= size; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)(data + i));
+    n += popcount32((unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, c0)));
+  }
+
+  return n + count_scalar(data + i, size - i, c);
+}
+
+#endif // CPU_X86_64
+
+static find_fn_t find_impl = find_scalar;
+static count_fn_t count_impl = count_scalar;
+
+// Picks the kernels for this processor, once: slice_find and
+// slice_count are called by the parser threads at the same time.
+static void slice_resolve(void) {
+#ifdef CPU_X86_64
+  int avx2 = cpu_has_avx2();
+  find_impl = avx2 ? find_avx2 : find_sse2;
+  count_impl = avx2 ? count_avx2 : count_sse2;
+#endif
+}
+
+#ifdef _WIN32
+static INIT_ONCE slice_once = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK slice_resolve_once(PINIT_ONCE once, PVOID param, PVOID* ctx) {
+  (void)once; (void)param; (void)ctx;
+  slice_resolve();
+  return TRUE;
+}
+
+static void slice_dispatch(void) {
+  InitOnceExecuteOnce(&slice_once, slice_resolve_once, NULL, NULL);
+}
+#else
+static pthread_once_t slice_once = PTHREAD_ONCE_INIT;
+
+static void slice_dispatch(void) {
+  pthread_once(&slice_once, slice_resolve);
+}
+#endif
+
+size_t slice_count(const slice_t* s, char c) {
+  if (!s || !s->data) return 0;
+  slice_dispatch();
+  return count_impl(s->data, s->size, c);
+}
+
+size_t slice_find(const slice_t* s, size_t from, const char* sep, size_t sep_len) {
+  if (!s || !s->data || sep_len == 0 || from >= s->size) return s ? s->size : 0;
+  slice_dispatch();
+  return from + find_impl(s->data + from, s->size - from, sep, sep_len);
+}
+
+int slice_eq_nocase(const slice_t* s, const char* str) {
+  for (size_t i = 0; i < s->size; i++) {
+    if (str[i] == '\0' || tolower((unsigned char)s->data[i]) != tolower((unsigned char)str[i])) return 0;
+  }
+  return str[s->size] == '\0';
+}
+
 void split(slice_t* s, const char* sep, unsigned int limit, slicearr_t* sa) {
   if (!s || !s->data) return;
   if (!sa) return;
   size_t start = 0;
   size_t sep_len = strlen(sep);
-  for (size_t i=0; i < s->size && (limit == 0 || sa->count < limit); i++) {
-    if (s->size - i >= sep_len && memcmp(s->data + i, sep, sep_len) == 0) {
-      da_append(sa, ((slice_t){ .data = s->data + start, .size = i - start }));
-      i += sep_len - 1;
-      start = i + 1;
-    }
+  while (sep_len > 0 && (limit == 0 || sa->count < limit)) {
+    size_t i = slice_find(s, start, sep, sep_len);
+    if (i >= s->size) break;
+    da_append(sa, ((slice_t){ .data = s->data + start, .size = i - start }));
+    start = i + sep_len;
   }
   da_append(sa, ((slice_t){ .data = s->data + start, .size = s->size - start }));
 }
 
+// FNV-1a
+uint64_t slice_hash(const slice_t* s) {
+  uint64_t h = 0xcbf29ce484222325ull;
+  for (size_t i = 0; i < s->size; i++) {
+    h ^= (unsigned char)s->data[i];
+    h *= 0x100000001b3ull;
+  }
+  return h;
+}
+
 int sized_atoi(const char* data, size_t size) {
   int n = 0;
   int sign = 1;
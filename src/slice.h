@@ -2,6 +2,7 @@
 #define _SLICE_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 typedef struct {
   char* data;
@@ -20,8 +21,13 @@ typedef struct {
   (strlen(str) <= (s)->size && memcmp((s)->data, str, strlen(str)) == 0)
 
 #define slice_eq(s, str) \
-  ((s)->size > 0 && memcmp((s)->data, str, (s)->size) == 0)
+  ((s)->size == strlen(str) && memcmp((s)->data, str, (s)->size) == 0)
 
+// Like slice_eq, ignoring the case of ASCII letters
+int slice_eq_nocase(const slice_t* s, const char* str);
+size_t slice_find(const slice_t* s, size_t from, const char* sep, size_t sep_len);
+size_t slice_count(const slice_t* s, char c);
+uint64_t slice_hash(const slice_t* s);
 void split(slice_t* s, const char* sep, unsigned int limit, slicearr_t* sa);
 int sized_atoi(const char* data, size_t size);
 int slice_atoi(slice_t *s);
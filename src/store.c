@@ -0,0 +1,477 @@
+#include "store.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#include "cpu.h"
+#include "da.h"
+#include "timestamp.h"
+
+typedef struct {
+  int64_t start;
+  uint32_t cal;
+  uint32_t event;
+} store_key_t;
+
+#define STORE_RADIX_BITS 8
+#define STORE_RADIX_SIZE (1 << STORE_RADIX_BITS)
+#define STORE_RADIX_PASSES (64 / STORE_RADIX_BITS)
+
+// Flipping the sign bit makes signed starts sort as unsigned
+static uint64_t store_radix_key(const store_key_t* k, int pass) {
+  uint64_t u = (uint64_t)k->start ^ ((uint64_t)1 << 63);
+  return (u >> (pass * STORE_RADIX_BITS)) & (STORE_RADIX_SIZE - 1);
+}
+
+// LSD radix sort on start, stable: keys filled in calendar order keep
+// it for events starting together. Passes where every key has the
+// same digit are skipped, usually the top ones since starts are close
+// to each other. `tmp` must hold `count` keys.
+// @return the array holding the sorted keys, keys or tmp.
+static store_key_t* store_radix_sort(store_key_t* keys, store_key_t* tmp, size_t count) {
+  size_t histogram[STORE_RADIX_PASSES][STORE_RADIX_SIZE] = { 0 };
+  for (size_t i = 0; i < count; i++) {
+    for (int pass = 0; pass < STORE_RADIX_PASSES; pass++) histogram[pass][store_radix_key(keys + i, pass)]++;
+  }
+
+  store_key_t* src = keys;
+  store_key_t* dst = tmp;
+  for (int pass = 0; pass < STORE_RADIX_PASSES; pass++) {
+    size_t* h = histogram[pass];
+    if (count == 0 || h[store_radix_key(src, pass)] == count) continue;
+
+    size_t offset = 0;
+    for (size_t d = 0; d < STORE_RADIX_SIZE; d++) {
+      size_t n = h[d];
+      h[d] = offset;
+      offset += n;
+    }
+    for (size_t i = 0; i < count; i++) dst[h[store_radix_key(src + i, pass)]++] = src[i];
+
+    store_key_t* t = src;
+    src = dst;
+    dst = t;
+  }
+  return src;
+}
+
+static int store_hit_cmp(const void* a, const void* b) {
+  const event_hit_t* ha = a;
+  const event_hit_t* hb = b;
+  if (ha->start != hb->start) return (ha->start > hb->start) - (ha->start < hb->start);
+  if (ha->cal != hb->cal) return (ha->cal > hb->cal) - (ha->cal < hb->cal);
+  return (ha->event > hb->event) - (ha->event < hb->event);
+}
+
+// Events without a duration last for their first second
+#define STORE_END(store, i) \
+  ((store)->end[i] > (store)->start[i] ? (store)->end[i] : (store)->start[i] + 1)
+
+// Leaves are the even rows, each level above fills max_end of its
+// nodes from their children. Children past the last row are replaced
+// by the last node of the level below, which covers them.
+static void store_index(event_store_t* store) {
+  size_t n = store->count;
+  int64_t* max_end = store->max_end;
+
+  size_t last_i = 0;
+  int64_t last = 0;
+  for (size_t i = 0; i < n; i += 2) {
+    last_i = i;
+    last = max_end[i] = STORE_END(store, i);
+  }
+
+  int k = 1;
+  for (; (size_t)1 << k <= n; k++) {
+    size_t x = (size_t)1 << (k - 1);
+    size_t i0 = (x << 1) - 1;
+    size_t step = x << 2;
+    for (size_t i = i0; i < n; i += step) {
+      int64_t left = max_end[i - x];
+      int64_t right = i + x < n ? max_end[i + x] : last;
+      int64_t e = STORE_END(store, i);
+      if (left > e) e = left;
+      if (right > e) e = right;
+      max_end[i] = e;
+    }
+    last_i = (last_i >> k & 1) ? last_i - x : last_i + x;
+    if (last_i < n && max_end[last_i] > last) last = max_end[last_i];
+  }
+  store->max_level = k - 1;
+}
+
+int event_store_build(event_store_t* store, const calendararr_t* calendars) {
+  memset(store, 0, sizeof(*store));
+  store->calendars = calendars;
+
+  size_t count = 0;
+  size_t rec_count = 0;
+  for (size_t c = 0; c < calendars->count; c++) {
+    const eventarr_t* events = &calendars->items[c].events;
+    for (size_t e = 0; e < events->count; e++) {
+      if (events->items[e].rrule) rec_count++;
+      else count++;
+    }
+  }
+
+  store_key_t* keys = malloc(2 * (count + 1) * sizeof(*keys));
+  store->start = malloc((count + 1) * sizeof(*store->start));
+  store->end = malloc((count + 1) * sizeof(*store->end));
+  store->max_end = malloc((count + 1) * sizeof(*store->max_end));
+  store->cal = malloc((count + 1) * sizeof(*store->cal));
+  store->event = malloc((count + 1) * sizeof(*store->event));
+  store->rec_cal = malloc((rec_count + 1) * sizeof(*store->rec_cal));
+  store->rec_event = malloc((rec_count + 1) * sizeof(*store->rec_event));
+  store->rec_uid_hash = malloc((rec_count + 1) * sizeof(*store->rec_uid_hash));
+  if (!keys || !store->start || !store->end || !store->max_end || !store->cal || !store->event
+      || !store->rec_cal || !store->rec_event || !store->rec_uid_hash) {
+    free(keys);
+    event_store_free(store);
+    return 1;
+  }
+
+  size_t n = 0;
+  for (size_t c = 0; c < calendars->count; c++) {
+    const eventarr_t* events = &calendars->items[c].events;
+    for (size_t e = 0; e < events->count; e++) {
+      if (events->items[e].rrule) {
+        store->rec_cal[store->rec_count] = (uint32_t)c;
+        store->rec_event[store->rec_count] = (uint32_t)e;
+        store->rec_uid_hash[store->rec_count] = instance_hash(events->items[e].uid);
+        store->rec_count++;
+        continue;
+      }
+      keys[n++] = (store_key_t){ .start = events->items[e].start, .cal = (uint32_t)c, .event = (uint32_t)e };
+    }
+  }
+
+  const store_key_t* sorted = store_radix_sort(keys, keys + count + 1, count);
+
+  for (size_t i = 0; i < count; i++) {
+    const event_t* e = &calendars->items[sorted[i].cal].events.items[sorted[i].event];
+    store->start[i] = e->start;
+    store->end[i] = e->end;
+    store->cal[i] = sorted[i].cal;
+    store->event[i] = sorted[i].event;
+  }
+  store->count = count;
+  store_index(store);
+
+  free(keys);
+  return 0;
+}
+
+void event_store_free(event_store_t* store) {
+  free(store->start);
+  free(store->end);
+  free(store->max_end);
+  free(store->cal);
+  free(store->event);
+  free(store->rec_cal);
+  free(store->rec_event);
+  free(store->rec_uid_hash);
+  memset(store, 0, sizeof(*store));
+}
+
+size_t event_store_lower_bound(const event_store_t* store, int64_t t) {
+  size_t lo = 0;
+  size_t hi = store->count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (store->start[mid] < t) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+// Subtrees this small are scanned instead of walked
+#define STORE_SCAN_LEVEL 3
+
+typedef struct {
+  size_t x;
+  int k;
+  int left_done;
+} store_node_t;
+
+#define STORE_HIT(store, i) ((event_hit_t){ \
+  .start = (store)->start[i],                 \
+  .end = (store)->end[i],                     \
+  .cal = (store)->cal[i],                     \
+  .event = (store)->event[i],                 \
+})
+
+static void store_query_tree(const event_store_t* store, int64_t start, int64_t end, event_hits_t* hits) {
+  if (store->count == 0) return;
+
+  // in-order walk, pruning subtrees that end before the range and
+  // stopping at rows that start after it
+  store_node_t stack[64];
+  size_t top = 0;
+  stack[top++] = (store_node_t){ .x = ((size_t)1 << store->max_level) - 1, .k = store->max_level };
+
+  while (top > 0) {
+    store_node_t t = stack[--top];
+    if (t.k <= STORE_SCAN_LEVEL) {
+      size_t i = t.x >> t.k << t.k;
+      size_t i1 = i + ((size_t)1 << (t.k + 1)) - 1;
+      if (i1 > store->count) i1 = store->count;
+      for (; i < i1 && store->start[i] < end; i++) {
+        if (STORE_END(store, i) > start) da_append(hits, STORE_HIT(store, i));
+      }
+    } else if (!t.left_done) {
+      size_t y = t.x - ((size_t)1 << (t.k - 1));
+      stack[top++] = (store_node_t){ .x = t.x, .k = t.k, .left_done = 1 };
+      if (y >= store->count || store->max_end[y] > start) {
+        stack[top++] = (store_node_t){ .x = y, .k = t.k - 1 };
+      }
+    } else if (t.x < store->count && store->start[t.x] < end) {
+      if (STORE_END(store, t.x) > start) da_append(hits, STORE_HIT(store, t.x));
+      stack[top++] = (store_node_t){ .x = t.x + ((size_t)1 << (t.k - 1)), .k = t.k - 1 };
+    }
+  }
+}
+
+// Rows selected per call of the scan kernel
+#define STORE_SELECT_BLOCK 1024
+// Picked on 1M events over 5 years, see event_store_query
+#define STORE_SCAN_RATIO 4
+
+typedef size_t (*select_fn_t)(const int64_t* start, const int64_t* end, size_t count, int64_t lo, int64_t hi, uint32_t base, uint32_t* sel);
+
+// Branchless, the index is always written and only kept if the row matches
+static size_t select_scalar(const int64_t* start, const int64_t* end, size_t count, int64_t lo, int64_t hi, uint32_t base, uint32_t* sel) {
+  size_t n = 0;
+  for (size_t i = 0; i < count; i++) {
+    int64_t e = end[i] > start[i] ? end[i] : start[i] + 1;
+    sel[n] = base + (uint32_t)i;
+    n += (start[i] < hi) & (e > lo);
+  }
+  return n;
+}
+
+#ifdef CPU_X86_64
+// lanes set in each 4-bit mask, packed to the front
+static const uint32_t select_lanes[16][4] = {
+  { 0, 0, 0, 0 }, { 0, 0, 0, 0 }, { 1, 0, 0, 0 }, { 0, 1, 0, 0 },
+  { 2, 0, 0, 0 }, { 0, 2, 0, 0 }, { 1, 2, 0, 0 }, { 0, 1, 2, 0 },
+  { 3, 0, 0, 0 }, { 0, 3, 0, 0 }, { 1, 3, 0, 0 }, { 0, 1, 3, 0 },
+  { 2, 3, 0, 0 }, { 0, 2, 3, 0 }, { 1, 2, 3, 0 }, { 0, 1, 2, 3 },
+};
+
+// Four rows per step, the indices of the matching ones are stored
+// with a single unaligned store and n moves by the popcount of the mask.
+TARGET_AVX2
+static size_t select_avx2(const int64_t* start, const int64_t* end, size_t count, int64_t lo, int64_t hi, uint32_t base, uint32_t* sel) {
+  size_t i = 0;
+  size_t n = 0;
+  __m256i vlo = _mm256_set1_epi64x(lo);
+  __m256i vhi = _mm256_set1_epi64x(hi);
+  __m256i one = _mm256_set1_epi64x(1);
+
+  for (; i + 4 <= count; i += 4) {
+    __m256i s = _mm256_loadu_si256((const __m256i*)(start + i));
+    __m256i e = _mm256_loadu_si256((const __m256i*)(end + i));
+    // like STORE_END
+    e = _mm256_blendv_epi8(_mm256_add_epi64(s, one), e, _mm256_cmpgt_epi64(e, s));
+    __m256i m = _mm256_and_si256(_mm256_cmpgt_epi64(vhi, s), _mm256_cmpgt_epi64(e, vlo));
+    unsigned int mask = (unsigned int)_mm256_movemask_pd(_mm256_castsi256_pd(m));
+    __m128i lanes = _mm_loadu_si128((const __m128i*)select_lanes[mask]);
+    _mm_storeu_si128((__m128i*)(sel + n), _mm_add_epi32(lanes, _mm_set1_epi32((int)(base + i))));
+    n += popcount32(mask);
+  }
+
+  return n + select_scalar(start + i, end + i, count - i, lo, hi, base + (uint32_t)i, sel + n);
+}
+#endif // CPU_X86_64
+
+static select_fn_t select_impl = select_scalar;
+
+// Picks the kernel for this processor, once: queries may run on
+// several threads.
+static void select_resolve(void) {
+#ifdef CPU_X86_64
+  if (cpu_has_avx2()) select_impl = select_avx2;
+#endif
+}
+
+#ifdef _WIN32
+static INIT_ONCE select_once = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK select_resolve_once(PINIT_ONCE once, PVOID param, PVOID* ctx) {
+  (void)once; (void)param; (void)ctx;
+  select_resolve();
+  return TRUE;
+}
+
+static void select_dispatch(void) {
+  InitOnceExecuteOnce(&select_once, select_resolve_once, NULL, NULL);
+}
+#else
+static pthread_once_t select_once = PTHREAD_ONCE_INIT;
+
+static void select_dispatch(void) {
+  pthread_once(&select_once, select_resolve);
+}
+#endif
+
+size_t event_store_select(const event_store_t* store, size_t from, size_t to, int64_t start, int64_t end, uint32_t* sel) {
+  select_dispatch();
+  return select_impl(store->start + from, store->end + from, to - from, start, end, (uint32_t)from, sel);
+}
+
+// Scans the rows that can overlap the range in blocks, used instead
+// of the tree when most of them do.
+static void store_query_scan(const event_store_t* store, int64_t start, int64_t end, size_t to, event_hits_t* hits) {
+  uint32_t sel[STORE_SELECT_BLOCK];
+  for (size_t from = 0; from < to; from += STORE_SELECT_BLOCK) {
+    size_t n = event_store_select(store, from, from + STORE_SELECT_BLOCK < to ? from + STORE_SELECT_BLOCK : to, start, end, sel);
+    da_reserve(hits, hits->count + n);
+    for (size_t j = 0; j < n; j++) hits->items[hits->count + j] = STORE_HIT(store, sel[j]);
+    hits->count += n;
+  }
+}
+
+// UTC offsets go from -12:00 to +14:00
+#define STORE_LOCAL_SLACK (14 * 3600)
+
+// Rules run on wall clock times, the iterators start early enough
+// for any time zone and every occurrence is checked once in UTC.
+// Occurrences excluded or overridden in their calendar are left out,
+// overrides are stored as plain events.
+static void store_query_recurring(const event_store_t* store, int64_t start, int64_t end, event_hits_t* hits) {
+  for (size_t i = 0; i < store->rec_count; i++) {
+    const calendar_t* cal = &store->calendars->items[store->rec_cal[i]];
+    const event_t* e = &cal->events.items[store->rec_event[i]];
+    int floating = (e->flags & EVENT_FLOATING) != 0;
+    int64_t duration = e->end - e->start;
+    int64_t slack = floating || e->tz ? STORE_LOCAL_SLACK : 0;
+
+    rrule_iter_t it;
+    rrule_iter_init(&it, e->rrule, start - duration - slack);
+
+    int64_t t = 0;
+    while (rrule_next(&it, &t) && t < end + slack) {
+      int64_t s = e->tz ? tz_local_to_utc(e->tz, t) : floating ? timestamp_local_to_utc(t) : t;
+      int64_t f = s + duration;
+      // like STORE_END
+      if (s >= end || (f > s ? f : s + 1) <= start) continue;
+      if (instance_set_has(&cal->exceptions, e->uid, store->rec_uid_hash[i], s)) continue;
+      da_append(hits, ((event_hit_t){ .start = s, .end = f, .cal = store->rec_cal[i], .event = store->rec_event[i] }));
+    }
+  }
+}
+
+void event_store_query(const event_store_t* store, int64_t start, int64_t end, event_hits_t* hits) {
+  size_t from = hits->count;
+
+  // the tree prunes the rows ending before the range, once most of
+  // the rows up to its end start inside it a straight scan is cheaper
+  size_t to = event_store_lower_bound(store, end);
+  if (event_store_lower_bound(store, start) <= to / STORE_SCAN_RATIO) {
+    store_query_scan(store, start, end, to, hits);
+  } else {
+    store_query_tree(store, start, end, hits);
+  }
+  size_t tree_count = hits->count;
+  store_query_recurring(store, start, end, hits);
+
+  // tree and scan hits are already in order
+  if (hits->count > tree_count) {
+    qsort(hits->items + from, hits->count - from, sizeof(*hits->items), store_hit_cmp);
+  }
+}
+
+const event_t* event_store_event(const event_store_t* store, const event_hit_t* hit) {
+  return &store->calendars->items[hit->cal].events.items[hit->event];
+}
+
+// Copies of an occurrence share the UID and the instance: the start
+// for occurrences of a rule, the replaced occurrence for overrides.
+static int64_t store_hit_instance(const event_t* e, const event_hit_t* hit) {
+  return e->rrule ? hit->start : e->recurrence_id;
+}
+
+// The newest copy has the highest SEQUENCE, then the latest DTSTAMP
+static int store_event_newer(const event_t* a, const event_t* b) {
+  if (a->sequence != b->sequence) return a->sequence > b->sequence;
+  return a->dtstamp > b->dtstamp;
+}
+
+static int store_uid_eq(const event_t* a, const event_t* b) {
+  if (a->uid.size != b->uid.size) return 0;
+  // interned UIDs are equal when they are the same copy
+  return a->uid.data == b->uid.data || memcmp(a->uid.data, b->uid.data, a->uid.size) == 0;
+}
+
+typedef struct {
+  // 0 marks an empty slot
+  uint64_t key;
+  size_t hit;
+} store_slot_t;
+
+size_t event_store_dedup(const event_store_t* store, event_hits_t* hits) {
+  size_t count = hits->count;
+  if (count < 2) return 0;
+
+  size_t capacity = 16;
+  while (capacity < count * 2) capacity *= 2;
+  size_t mask = capacity - 1;
+
+  store_slot_t* slots = calloc(capacity, sizeof(*slots));
+  unsigned char* dropped = calloc(count, sizeof(*dropped));
+  if (!slots || !dropped) {
+    free(slots);
+    free(dropped);
+    return 0;
+  }
+
+  size_t removed = 0;
+  for (size_t i = 0; i < count; i++) {
+    const event_hit_t* hit = hits->items + i;
+    const event_t* e = event_store_event(store, hit);
+    if (e->uid.size == 0) continue;
+
+    int64_t instant = store_hit_instance(e, hit);
+    uint64_t key = instance_key(instance_hash(e->uid), instant);
+
+    size_t j = (size_t)key & mask;
+    const event_t* other = NULL;
+    for (; slots[j].key != 0; j = (j + 1) & mask) {
+      if (slots[j].key != key) continue;
+      const event_hit_t* h = hits->items + slots[j].hit;
+      const event_t* o = event_store_event(store, h);
+      if (store_hit_instance(o, h) == instant && store_uid_eq(o, e)) {
+        other = o;
+        break;
+      }
+    }
+
+    if (!other) {
+      slots[j] = (store_slot_t){ .key = key, .hit = i };
+    } else if (store_event_newer(e, other)) {
+      dropped[slots[j].hit] = 1;
+      slots[j].hit = i;
+      removed++;
+    } else {
+      dropped[i] = 1;
+      removed++;
+    }
+  }
+
+  size_t n = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (!dropped[i]) hits->items[n++] = hits->items[i];
+  }
+  hits->count = n;
+
+  free(slots);
+  free(dropped);
+  return removed;
+}
@@ -0,0 +1,102 @@
+#ifndef STORE_H
+#define STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ics.h"
+
+/*
+ * Occurrence of an event returned by a query.
+ */
+typedef struct {
+  int64_t start;
+  int64_t end;
+  uint32_t cal;
+  uint32_t event;
+} event_hit_t;
+
+typedef struct {
+  event_hit_t* items;
+  size_t count;
+  size_t capacity;
+} event_hits_t;
+
+/*
+ * Columnar view of the events of a set of calendars, sorted by start
+ * time. Row i is event `event[i]` of calendar `cal[i]`, the text is
+ * read from there (see event_store_event) while time queries only
+ * touch the time columns.
+ * The rows also form an implicit interval tree: row i is a node of
+ * level k if its lowest k bits are set and the next one is clear, its
+ * children are i -/+ 2^(k-1). `max_end[i]` is the latest end in the
+ * subtree of i.
+ */
+typedef struct {
+  int64_t* start;
+  int64_t* end;
+  int64_t* max_end;
+  uint32_t* cal;
+  uint32_t* event;
+  size_t count;
+  // level of the root
+  int max_level;
+  // recurring events, expanded by every query
+  uint32_t* rec_cal;
+  uint32_t* rec_event;
+  // instance_hash of their UID, to look up their exceptions
+  uint64_t* rec_uid_hash;
+  size_t rec_count;
+  const calendararr_t* calendars;
+} event_store_t;
+
+/*
+ * Builds the store from the events of calendars, which must outlive it.
+ * @param store pointer to event_store_t structure
+ * @param calendars calendars holding the events
+ * @return 0 on success, 1 if out of memory.
+ */
+int event_store_build(event_store_t* store, const calendararr_t* calendars);
+/*
+ * Frees the columns of the store.
+ * @param store pointer to event_store_t structure
+ */
+void event_store_free(event_store_t* store);
+/*
+ * @return the index of the first event starting at or after t,
+ *         store->count if there is none.
+ */
+size_t event_store_lower_bound(const event_store_t* store, int64_t t);
+/*
+ * Finds the rows in [from, to) overlapping [start, end) with a single
+ * pass over the time columns, testing several rows per instruction
+ * where the processor allows it. Recurring events are not expanded.
+ * @param store pointer to event_store_t structure
+ * @param sel buffer of at least to - from indices, filled with the
+ *        matching rows in order
+ * @return the amount of rows selected.
+ */
+size_t event_store_select(const event_store_t* store, size_t from, size_t to, int64_t start, int64_t end, uint32_t* sel);
+/*
+ * Selects the occurrences overlapping [start, end), in order of start
+ * time. Events without a duration overlap the range if they start
+ * inside it.
+ * @param store pointer to event_store_t structure
+ * @param hits array the occurrences are appended to
+ */
+void event_store_query(const event_store_t* store, int64_t start, int64_t end, event_hits_t* hits);
+/*
+ * Removes the copies of the same occurrence found in several
+ * calendars, keeping the newest one (highest SEQUENCE, then latest
+ * DTSTAMP). The remaining hits keep their order.
+ * @param store pointer to event_store_t structure
+ * @param hits occurrences returned by event_store_query
+ * @return the amount of hits removed.
+ */
+size_t event_store_dedup(const event_store_t* store, event_hits_t* hits);
+/*
+ * @return the event_t holding the text of hit.
+ */
+const event_t* event_store_event(const event_store_t* store, const event_hit_t* hit);
+
+#endif // STORE_H
@@ -0,0 +1,107 @@
+#include "thread.h"
+
+#include <stdlib.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#include "logging.h"
+
+typedef struct {
+  volatile size_t next;
+  size_t jobs;
+  job_fn_t fn;
+  void* ctx;
+} pool_t;
+
+typedef struct {
+  pool_t* pool;
+  size_t id;
+} worker_t;
+
+static size_t pool_next(pool_t* pool) {
+#ifdef _WIN32
+  return (size_t)InterlockedIncrement64((volatile LONG64*)&pool->next) - 1;
+#else
+  return __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+#endif
+}
+
+static void worker_run(worker_t* w) {
+  pool_t* pool = w->pool;
+  for (size_t job = pool_next(pool); job < pool->jobs; job = pool_next(pool)) {
+    pool->fn(pool->ctx, job, w->id);
+  }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI worker_main(LPVOID arg) {
+  worker_run((worker_t*)arg);
+  return 0;
+}
+#else
+static void* worker_main(void* arg) {
+  worker_run((worker_t*)arg);
+  return NULL;
+}
+#endif
+
+size_t thread_count(void) {
+#ifdef _WIN32
+  SYSTEM_INFO si = { 0 };
+  GetSystemInfo(&si);
+  return si.dwNumberOfProcessors > 0 ? (size_t)si.dwNumberOfProcessors : 1;
+#else
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (size_t)n : 1;
+#endif
+}
+
+void parallel_for(size_t jobs, size_t threads, job_fn_t fn, void* ctx) {
+  if (jobs == 0) return;
+  if (threads == 0) threads = thread_count();
+  if (threads > jobs) threads = jobs;
+
+  pool_t pool = { .next = 0, .jobs = jobs, .fn = fn, .ctx = ctx };
+
+  worker_t* workers = malloc(threads * sizeof(*workers));
+#ifdef _WIN32
+  HANDLE* handles = malloc(threads * sizeof(*handles));
+#else
+  pthread_t* handles = malloc(threads * sizeof(*handles));
+#endif
+  if (!workers || !handles) threads = 1;
+
+  // worker 0 is the calling thread
+  size_t spawned = 1;
+  for (; spawned < threads; spawned++) {
+    workers[spawned] = (worker_t){ .pool = &pool, .id = spawned };
+#ifdef _WIN32
+    handles[spawned] = CreateThread(NULL, 0, worker_main, &workers[spawned], 0, NULL);
+    if (handles[spawned] == NULL) break;
+#else
+    if (pthread_create(&handles[spawned], NULL, worker_main, &workers[spawned])) break;
+#endif
+  }
+  if (spawned < threads) LOG_WARN("Could only start %zu of %zu threads", spawned, threads);
+
+  worker_t self = { .pool = &pool, .id = 0 };
+  worker_run(&self);
+
+  for (size_t i = 1; i < spawned; i++) {
+#ifdef _WIN32
+    WaitForSingleObject(handles[i], INFINITE);
+    CloseHandle(handles[i]);
+#else
+    pthread_join(handles[i], NULL);
+#endif
+  }
+
+  free(workers);
+  free(handles);
+}
@@ -0,0 +1,29 @@
+#ifndef THREAD_H
+#define THREAD_H
+
+#include <stddef.h>
+
+/*
+ * Job run by parallel_for.
+ * @param ctx pointer passed to parallel_for
+ * @param job index of the job, in [0, jobs)
+ * @param worker index of the thread running the job, in [0, threads)
+ */
+typedef void (*job_fn_t)(void* ctx, size_t job, size_t worker);
+
+/*
+ * @return the number of processors available to the process.
+ */
+size_t thread_count(void);
+/*
+ * Runs fn for every job in [0, jobs) on at most `threads` threads.
+ * The calling thread is one of the workers, jobs are handed out
+ * in order as workers become free. Returns when all jobs are done.
+ * @param jobs amount of jobs to run
+ * @param threads maximum amount of threads, 0 means thread_count()
+ * @param fn function to run for every job
+ * @param ctx pointer passed to fn
+ */
+void parallel_for(size_t jobs, size_t threads, job_fn_t fn, void* ctx);
+
+#endif // THREAD_H
@@ -1,161 +1,339 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "timestamp.h"
 
-timestamp_t now() {
-#ifdef _WIN32
-  SYSTEMTIME st = { 0 };
-  GetLocalTime(&st);
-  return (timestamp_t) {
-    .y = st.wYear,
-    .m = st.wMonth,
-    .d = st.wDay,
-    .hh = st.wHour,
-    .mm = st.wMinute,
-    .ss = st.wSecond,
-  };
-#else
-  time_t t;
-  time(&t);
-  struct tm *tm = localtime(&t);
-  return (timestamp_t) {
-    .y = tm->tm_year + 1900,
-    .m = tm->tm_mon + 1,
-    .d = tm->tm_mday,
-    .hh = tm->tm_hour,
-    .mm = tm->tm_min,
-    .ss = tm->tm_sec,
-  };
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#ifndef _WIN32
+static time_t timestamp_to_systime(timestamp_t t) {
+  struct tm tm = { 0 };
+  tm.tm_year = t.y - 1900;
+  tm.tm_mon  = t.m - 1;
+  tm.tm_mday = t.d;
+  tm.tm_hour = t.hh;
+  tm.tm_min  = t.mm;
+  tm.tm_sec  = t.ss;
+  tm.tm_isdst = -1;
+
+  return mktime(&tm);
+}
+#endif
+
+// Days between 1970-01-01 and y-m-d in the proleptic Gregorian calendar.
+// http://howardhinnant.github.io/date_algorithms.html
+static int64_t days_from_civil(int64_t y, unsigned m, unsigned d) {
+  y -= m <= 2;
+  int64_t era = (y >= 0 ? y : y - 399) / 400;
+  unsigned yoe = (unsigned)(y - era * 400);
+  unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+  unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + (int64_t)doe - 719468;
+}
+
+static void civil_from_days(int64_t z, int* y, int* m, int* d) {
+  z += 719468;
+  int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+  unsigned doe = (unsigned)(z - era * 146097);
+  unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  unsigned mp = (5 * doy + 2) / 153;
+  *d = (int)(doy - (153 * mp + 2) / 5 + 1);
+  *m = (int)(mp < 10 ? mp + 3 : mp - 9);
+  *y = (int)(yoe + era * 400 + (*m <= 2));
+}
+
+void timestamp_day_print(timestamp_t t) {
+  static const char* names[] = { "Monday", "Tuesday", "Wednesday", "Thursday", "Friday", "Saturday", "Sunday" };
+  // 1970-01-01 was a Thursday
+  int64_t days = days_from_civil(t.y, (unsigned)t.m, (unsigned)t.d);
+  int64_t wd = ((days + 3) % 7 + 7) % 7;
+  printf("%s - %02d/%02d/%d", names[wd], t.d, t.m, t.y);
+}
+
+static int days_in_month(int y, int m) {
+  static const int days[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+  if (m == 2 && (y % 4 == 0 && (y % 100 != 0 || y % 400 == 0))) return 29;
+  return days[m - 1];
+}
+
+// Loads n <= 8 characters, the first one in the low byte. Missing
+// characters are padded with '0'.
+static uint64_t swar_load(const char* data, size_t n) {
+  uint64_t v = 0x3030303030303030ull;
+  memcpy(&v, data, n);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  v = __builtin_bswap64(v);
 #endif
+  return v;
+}
+
+// Converts 8 ASCII digits into four 2-digit numbers, one per 16-bit lane.
+// @return 0 if any of the characters is not a digit.
+static int swar_digits(uint64_t v, uint64_t* pairs) {
+  v ^= 0x3030303030303030ull;
+  // every byte must now be 0..9: adding 0x76 sets the high bit of larger ones
+  if (((v + 0x7676767676767676ull) | v) & 0x8080808080808080ull) return 0;
+  *pairs = ((v & 0x0F0F0F0F0F0F0F0Full) * (10 * 256 + 1)) >> 8 & 0x00FF00FF00FF00FFull;
+  return 1;
+}
+
+int64_t timestamp_parse(const char* data, size_t size, int* flags) {
+  int f = 0;
+  int hh = 0, mm = 0, ss = 0;
+  uint64_t pairs = 0;
+
+  if (size != 8 && size != 15 && size != 16) return TIMESTAMP_INVALID;
+
+  if (!swar_digits(swar_load(data, 8), &pairs)) return TIMESTAMP_INVALID;
+  int y = (int)(pairs & 0xFF) * 100 + (int)(pairs >> 16 & 0xFF);
+  int m = (int)(pairs >> 32 & 0xFF);
+  int d = (int)(pairs >> 48 & 0xFF);
+
+  if (size == 8) {
+    f |= TIMESTAMP_DATE;
+  } else {
+    if (data[8] != 'T') return TIMESTAMP_INVALID;
+    if (size == 16) {
+      if (data[15] != 'Z') return TIMESTAMP_INVALID;
+      f |= TIMESTAMP_UTC;
+    }
+    if (!swar_digits(swar_load(data + 9, 6), &pairs)) return TIMESTAMP_INVALID;
+    hh = (int)(pairs & 0xFF);
+    mm = (int)(pairs >> 16 & 0xFF);
+    ss = (int)(pairs >> 32 & 0xFF);
+  }
+
+  if (m < 1 || m > 12 || d < 1 || d > days_in_month(y, m)) return TIMESTAMP_INVALID;
+  // 60 is a leap second
+  if (hh > 23 || mm > 59 || ss > 60) return TIMESTAMP_INVALID;
+
+  if (flags) *flags = f;
+  return days_from_civil(y, (unsigned)m, (unsigned)d) * 86400 + hh * 3600 + mm * 60 + ss;
+}
+
+timestamp_t timestamp_from_epoch(int64_t t) {
+  int64_t days = t >= 0 ? t / 86400 : (t - 86399) / 86400;
+  int64_t secs = t - days * 86400;
+
+  timestamp_t ts = {
+    .hh = (int)(secs / 3600),
+    .mm = (int)(secs / 60 % 60),
+    .ss = (int)(secs % 60),
+  };
+  civil_from_days(days, &ts.y, &ts.m, &ts.d);
+
+  return ts;
+}
+
+int64_t timestamp_to_epoch(timestamp_t t) {
+  return days_from_civil(t.y, (unsigned)t.m, (unsigned)t.d) * 86400 + t.hh * 3600 + t.mm * 60 + t.ss;
 }
 
-timestamp_t today_00() {
+static int64_t libc_local_to_utc(int64_t t) {
+  timestamp_t ts = timestamp_from_epoch(t);
 #ifdef _WIN32
-  SYSTEMTIME st = { 0 };
-  GetLocalTime(&st);
-  return (timestamp_t) {
-    .y = st.wYear,
-    .m = st.wMonth,
-    .d = st.wDay,
+  SYSTEMTIME local = {
+    .wYear = (WORD)ts.y,
+    .wMonth = (WORD)ts.m,
+    .wDay = (WORD)ts.d,
+    .wHour = (WORD)ts.hh,
+    .wMinute = (WORD)ts.mm,
+    .wSecond = (WORD)ts.ss,
   };
+  SYSTEMTIME utc = { 0 };
+  if (!TzSpecificLocalTimeToSystemTime(NULL, &local, &utc)) return t;
+
+  return timestamp_to_epoch((timestamp_t){
+    .y = utc.wYear,
+    .m = utc.wMonth,
+    .d = utc.wDay,
+    .hh = utc.wHour,
+    .mm = utc.wMinute,
+    .ss = utc.wSecond,
+  });
 #else
-  time_t t;
-  time(&t);
-  struct tm *tm = localtime(&t);
-  return (timestamp_t) {
-    .y = tm->tm_year + 1900,
-    .m = tm->tm_mon + 1,
-    .d = tm->tm_mday,
-  };
+  time_t utc = timestamp_to_systime(ts);
+  if (utc == (time_t)-1) return t;
+
+  return (int64_t)utc;
 #endif
 }
 
-timestamp_t today_24() {
+static timestamp_t libc_utc_to_local(int64_t t) {
 #ifdef _WIN32
-  SYSTEMTIME st = { 0 };
-  GetLocalTime(&st);
+  timestamp_t ts = timestamp_from_epoch(t);
+  SYSTEMTIME utc = {
+    .wYear = (WORD)ts.y,
+    .wMonth = (WORD)ts.m,
+    .wDay = (WORD)ts.d,
+    .wHour = (WORD)ts.hh,
+    .wMinute = (WORD)ts.mm,
+    .wSecond = (WORD)ts.ss,
+  };
+  SYSTEMTIME local = { 0 };
+  if (!SystemTimeToTzSpecificLocalTime(NULL, &utc, &local)) return ts;
+
   return (timestamp_t) {
-    .y = st.wYear,
-    .m = st.wMonth,
-    .d = st.wDay,
-    .hh = 23,
-    .mm = 59,
-    .ss = 59
+    .y = local.wYear,
+    .m = local.wMonth,
+    .d = local.wDay,
+    .hh = local.wHour,
+    .mm = local.wMinute,
+    .ss = local.wSecond,
   };
 #else
-  time_t t;
-  time(&t);
-  struct tm *tm = localtime(&t);
+  time_t utc = (time_t)t;
+  struct tm tm = { 0 };
+  if (!localtime_r(&utc, &tm)) return timestamp_from_epoch(t);
+
   return (timestamp_t) {
-    .y = tm->tm_year + 1900,
-    .m = tm->tm_mon + 1,
-    .d = tm->tm_mday,
-    .hh = 23,
-    .mm = 59,
-    .ss = 59
+    .y = tm.tm_year + 1900,
+    .m = tm.tm_mon + 1,
+    .d = tm.tm_mday,
+    .hh = tm.tm_hour,
+    .mm = tm.tm_min,
+    .ss = tm.tm_sec,
   };
 #endif
 }
 
+static int64_t epoch_now(void) {
 #ifdef _WIN32
-SYSTEMTIME timestamp_to_systime(timestamp_t t) {
-  SYSTEMTIME st = (SYSTEMTIME) {
-    .wYear = (WORD)t.y,
-    .wMonth = (WORD)t.m,
-    .wDay = (WORD)t.d,
-    .wHour = (WORD)t.hh,
-    .wMinute = (WORD)t.mm,
-    .wSecond = (WORD)t.ss,
-    .wMilliseconds = 0,
-  };
-  // force normalization
   FILETIME ft = { 0 };
-  SYSTEMTIME local;
-  SystemTimeToFileTime(&st, &ft);
-  FileTimeToSystemTime(&ft, &local);
-  return local;
-}
+  GetSystemTimeAsFileTime(&ft);
+  ULARGE_INTEGER li = {
+    .LowPart  = ft.dwLowDateTime,
+    .HighPart = ft.dwHighDateTime,
+  };
+  // FILETIME counts from 1601-01-01
+  return (int64_t)TO_SECS(li.QuadPart) - 11644473600LL;
 #else
-time_t timestamp_to_systime(timestamp_t t) {
-  struct tm tm = { 0 };
-  tm.tm_year = t.y - 1900;
-  tm.tm_mon  = t.m - 1;
-  tm.tm_mday = t.d;
-  tm.tm_hour = t.hh;
-  tm.tm_min  = t.mm;
-  tm.tm_sec  = t.ss;
-  tm.tm_isdst = -1;
-
-  return mktime(&tm);
-}
+  return (int64_t)time(NULL);
 #endif
+}
 
-int64_t timestamp_cmp(timestamp_t a, timestamp_t b) {
-#ifdef _WIN32
-  SYSTEMTIME sta = timestamp_to_systime(a);
-  SYSTEMTIME stb = timestamp_to_systime(b);
+// UTC offsets of the local time zone around the current year, read
+// once from the C library. Conversions in this range are plain
+// arithmetic, the C library is only asked about times outside of it.
+#define LOCAL_ZONE_MAX_CHANGES 16
 
-  FILETIME fta = { 0 };
-  FILETIME ftb = { 0 };
+static struct {
+  int ok;
+  // UTC range covered
+  int64_t from;
+  int64_t to;
+  // offset[i] holds from at[i] on, at[0] == from
+  int64_t at[LOCAL_ZONE_MAX_CHANGES];
+  int64_t offset[LOCAL_ZONE_MAX_CHANGES];
+  size_t count;
+} local_zone;
 
-  if (!SystemTimeToFileTime(&sta, &fta)) return -INT_MAX;
-  if (!SystemTimeToFileTime(&stb, &ftb)) return -INT_MAX;
+static int64_t libc_offset(int64_t t) {
+  return timestamp_to_epoch(libc_utc_to_local(t)) - t;
+}
 
-  LARGE_INTEGER lia = {
-    .LowPart  = fta.dwLowDateTime,
-    .HighPart = fta.dwHighDateTime,
-  };
-  LARGE_INTEGER lib = {
-    .LowPart  = ftb.dwLowDateTime,
-    .HighPart = ftb.dwHighDateTime,
-  };
+static void local_zone_init(void) {
+  // January 1st of last year to January 1st in two years
+  int y = timestamp_from_epoch(epoch_now()).y;
+  int64_t from = days_from_civil(y - 1, 1, 1) * 86400;
+  int64_t to = days_from_civil(y + 2, 1, 1) * 86400;
 
-  return lia.QuadPart - lib.QuadPart;
-#else
-  time_t sta = timestamp_to_systime(a);
-  time_t stb = timestamp_to_systime(b);
+  local_zone.from = from;
+  local_zone.to = to;
+  local_zone.at[0] = from;
+  local_zone.offset[0] = libc_offset(from);
+  local_zone.count = 1;
 
-  if (sta == (time_t)-1 || stb == (time_t)-1) return -INT64_MAX;
+  // zones change their offset at most once a day
+  int64_t offset = local_zone.offset[0];
+  for (int64_t t = from; t < to; t += 86400) {
+    int64_t next = libc_offset(t + 86400);
+    if (next == offset) continue;
 
-  return (int64_t)sta - (int64_t)stb;
-#endif
+    // first second with the new offset
+    int64_t lo = t, hi = t + 86400;
+    while (hi - lo > 1) {
+      int64_t mid = lo + (hi - lo) / 2;
+      if (libc_offset(mid) == offset) lo = mid;
+      else hi = mid;
+    }
+    if (local_zone.count == LOCAL_ZONE_MAX_CHANGES) return;
+    local_zone.at[local_zone.count] = hi;
+    local_zone.offset[local_zone.count] = next;
+    local_zone.count++;
+    offset = next;
+  }
+  local_zone.ok = 1;
 }
 
-void timestamp_day_print(timestamp_t t) {
 #ifdef _WIN32
-  PCSTR dn[] = { "Sunday", "Monday", "Tuesday", 
-  "Wednesday", "Thursday", "Friday", "Saturday" };
-  printf("%s - %d/%d/%d", dn[timestamp_to_systime(t).wDayOfWeek], t.d, t.m, t.y);
+static INIT_ONCE local_zone_once = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK local_zone_init_once(PINIT_ONCE once, PVOID param, PVOID* ctx) {
+  (void)once; (void)param; (void)ctx;
+  local_zone_init();
+  return TRUE;
+}
+
+static int local_zone_ready(void) {
+  InitOnceExecuteOnce(&local_zone_once, local_zone_init_once, NULL, NULL);
+  return local_zone.ok;
+}
 #else
-  time_t stt = timestamp_to_systime(t);
-  struct tm *tm = localtime(&stt);
+static pthread_once_t local_zone_once = PTHREAD_ONCE_INIT;
 
-  char buf[256];
-  size_t len = strftime(buf, sizeof(buf), "%A - %d/%m/%Y", tm);
-  if(len > 0)
-    printf("%s", buf);
+static int local_zone_ready(void) {
+  pthread_once(&local_zone_once, local_zone_init);
+  return local_zone.ok;
+}
 #endif
+
+// Offset at t, which must be in [from, to)
+static int64_t local_zone_offset(int64_t t) {
+  size_t i = local_zone.count - 1;
+  while (i > 0 && local_zone.at[i] > t) i--;
+  return local_zone.offset[i];
+}
+
+int64_t timestamp_local_to_utc(int64_t t) {
+  // local times are at most a day away from UTC
+  if (!local_zone_ready() || t - 86400 < local_zone.from || t + 86400 >= local_zone.to) {
+    return libc_local_to_utc(t);
+  }
+
+  // the offsets before and after t, the same unless it changes around t
+  int64_t before = local_zone_offset(t - 86400);
+  int64_t after = local_zone_offset(t + 86400);
+  if (local_zone_offset(t - before) == before) return t - before;
+  if (local_zone_offset(t - after) == after) return t - after;
+  // skipped by a forward change, read with the offset before it
+  return t - before;
 }
 
+timestamp_t timestamp_utc_to_local(int64_t t) {
+  if (!local_zone_ready() || t < local_zone.from || t >= local_zone.to) return libc_utc_to_local(t);
+  return timestamp_from_epoch(t + local_zone_offset(t));
+}
+
+void clock_snapshot(clock_snapshot_t* c) {
+  c->now = epoch_now();
+  c->local = timestamp_utc_to_local(c->now);
+
+  int64_t local = timestamp_to_epoch(c->local);
+  int64_t midnight = local - (c->local.hh * 3600 + c->local.mm * 60 + c->local.ss);
+  c->utc_offset = local - c->now;
+  c->day_start = timestamp_local_to_utc(midnight);
+  c->day_end = timestamp_local_to_utc(midnight + 86400);
+  c->fixed_offset = midnight - c->day_start == c->utc_offset
+                 && midnight + 86400 - c->day_end == c->utc_offset;
+}
+
+timestamp_t clock_local(const clock_snapshot_t* c, int64_t t) {
+  if (c->fixed_offset) return timestamp_from_epoch(t + c->utc_offset);
+  return timestamp_utc_to_local(t);
+}
@@ -1,3 +1,6 @@
+#ifndef TIMESTAMP_H
+#define TIMESTAMP_H
+
 #include <stdint.h>
 
 #ifdef _WIN32
@@ -19,14 +22,72 @@ typedef struct {
   char tz;
 } timestamp_t;
 
-timestamp_t now();
-timestamp_t today_00();
-timestamp_t today_24();
+// timestamp_parse flags
+#define TIMESTAMP_DATE 1 // no time part, all-day value
+#define TIMESTAMP_UTC  2 // trailing 'Z'
 
-#ifdef _WIN32
-SYSTEMTIME timestamp_to_systime(timestamp_t t);
-#endif
+#define TIMESTAMP_INVALID INT64_MIN
 
-int64_t timestamp_cmp(timestamp_t a, timestamp_t b); 
+/*
+ * The current time and the bounds of the local day, read once per
+ * run. Times are seconds since the Unix epoch.
+ */
+typedef struct {
+  int64_t now;
+  // now in the local time zone
+  timestamp_t local;
+  // local midnight starting and ending today, in UTC
+  int64_t day_start;
+  int64_t day_end;
+  // local time minus UTC at now, in seconds
+  int64_t utc_offset;
+  // whether the offset holds for the whole day (no DST change today)
+  int fixed_offset;
+} clock_snapshot_t;
 
 void timestamp_day_print(timestamp_t t);
+
+/*
+ * Decodes an iCalendar DATE or DATE-TIME (YYYYMMDD[THHMMSS[Z]]).
+ * @param data text of the value
+ * @param size length of the value
+ * @param flags if not NULL, set to a combination of TIMESTAMP_DATE and TIMESTAMP_UTC
+ * @return seconds between 1970-01-01T00:00:00 and the value, read as a
+ * wall clock time (no time zone is applied), TIMESTAMP_INVALID if the
+ * value is malformed.
+ */
+int64_t timestamp_parse(const char* data, size_t size, int* flags);
+/*
+ * Converts seconds since 1970-01-01T00:00:00 back to calendar fields.
+ */
+timestamp_t timestamp_from_epoch(int64_t t);
+/*
+ * Converts calendar fields to seconds since 1970-01-01T00:00:00,
+ * without applying any time zone.
+ */
+int64_t timestamp_to_epoch(timestamp_t t);
+/*
+ * Converts a wall clock time in the local time zone to UTC.
+ * @param t seconds since 1970-01-01T00:00:00, local time
+ * @return seconds since the Unix epoch.
+ */
+int64_t timestamp_local_to_utc(int64_t t);
+/*
+ * Converts seconds since the Unix epoch to calendar fields in the
+ * local time zone.
+ */
+timestamp_t timestamp_utc_to_local(int64_t t);
+/*
+ * Reads the clock and the local time zone.
+ * @param c pointer to clock_snapshot_t structure
+ */
+void clock_snapshot(clock_snapshot_t* c);
+/*
+ * Local calendar fields of a time of today, without asking the C
+ * library unless the UTC offset changes during the day.
+ * @param c snapshot taken by clock_snapshot
+ * @param t seconds since the Unix epoch, in [c->day_start, c->day_end]
+ */
+timestamp_t clock_local(const clock_snapshot_t* c, int64_t t);
+
+#endif // TIMESTAMP_H
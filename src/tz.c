@@ -0,0 +1,392 @@
+#include "tz.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#include "da.h"
+#include "logging.h"
+#include "sb.h"
+#include "timestamp.h"
+
+#define TZ_ID_MAX 128
+#define TZ_DEFAULT_DIR "/usr/share/zoneinfo"
+
+typedef struct {
+  int64_t* items;
+  size_t count;
+  size_t capacity;
+} tz_times_t;
+
+typedef struct {
+  int32_t* items;
+  size_t count;
+  size_t capacity;
+} tz_offsets_t;
+
+// Date of a POSIX TZ rule: Mm.w.d, Jn or n, and the local time of the change
+typedef struct {
+  char kind;
+  int m;
+  int w;
+  int d;
+  int32_t time;
+} tz_date_t;
+
+// Footer of a TZif file, e.g. CET-1CEST,M3.5.0,M10.5.0/3
+typedef struct {
+  int32_t std;
+  int32_t dst;
+  int has_dst;
+  tz_date_t start;
+  tz_date_t end;
+} tz_rule_t;
+
+static int32_t tz_be32(const unsigned char* p) {
+  return (int32_t)((uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | (uint32_t)p[3]);
+}
+
+static int64_t tz_be64(const unsigned char* p) {
+  return (int64_t)((uint64_t)(uint32_t)tz_be32(p) << 32 | (uint32_t)tz_be32(p + 4));
+}
+
+static int64_t tz_year_start(int y) {
+  return timestamp_to_epoch((timestamp_t){ .y = y, .m = 1, .d = 1 });
+}
+
+// [+-]hh[:mm[:ss]], hours may go up to 167 in rule times
+static const char* tz_parse_time(const char* s, int32_t* out) {
+  int sign = 1;
+  if (*s == '+' || *s == '-') sign = *s++ == '-' ? -1 : 1;
+  if (!isdigit((unsigned char)*s)) return NULL;
+
+  int32_t parts[3] = { 0 };
+  for (int i = 0; i < 3; i++) {
+    while (isdigit((unsigned char)*s)) parts[i] = parts[i] * 10 + (*s++ - '0');
+    if (i == 2 || *s != ':') break;
+    s++;
+  }
+  *out = sign * (parts[0] * 3600 + parts[1] * 60 + parts[2]);
+  return s;
+}
+
+static const char* tz_parse_name(const char* s) {
+  if (*s == '<') {
+    const char* end = strchr(s, '>');
+    return end ? end + 1 : NULL;
+  }
+  const char* start = s;
+  while (isalpha((unsigned char)*s)) s++;
+  return s - start >= 3 ? s : NULL;
+}
+
+static const char* tz_parse_date(const char* s, tz_date_t* d) {
+  *d = (tz_date_t){ .time = 2 * 3600 };
+  if (*s == 'M') {
+    d->kind = 'M';
+    char* end = NULL;
+    d->m = (int)strtol(s + 1, &end, 10);
+    if (*end != '.') return NULL;
+    d->w = (int)strtol(end + 1, &end, 10);
+    if (*end != '.') return NULL;
+    d->d = (int)strtol(end + 1, &end, 10);
+    s = end;
+    if (d->m < 1 || d->m > 12 || d->w < 1 || d->w > 5 || d->d < 0 || d->d > 6) return NULL;
+  } else {
+    d->kind = *s == 'J' ? 'J' : 'N';
+    if (*s == 'J') s++;
+    if (!isdigit((unsigned char)*s)) return NULL;
+    char* end = NULL;
+    d->d = (int)strtol(s, &end, 10);
+    s = end;
+  }
+  if (*s == '/') s = tz_parse_time(s + 1, &d->time);
+  return s;
+}
+
+// POSIX offsets are west of Greenwich, ours are east.
+// @return 0 on success, < 0 if the rule is malformed.
+static int tz_parse_rule(const char* s, tz_rule_t* r) {
+  memset(r, 0, sizeof(*r));
+
+  if (!(s = tz_parse_name(s))) return -1;
+  if (!(s = tz_parse_time(s, &r->std))) return -1;
+  r->std = -r->std;
+  if (*s == '\0') return 0;
+
+  if (!(s = tz_parse_name(s))) return -1;
+  r->has_dst = 1;
+  r->dst = r->std + 3600;
+  if (*s != ',' && *s != '\0') {
+    if (!(s = tz_parse_time(s, &r->dst))) return -1;
+    r->dst = -r->dst;
+  }
+
+  // the US rules are the default
+  if (*s == '\0') s = ",M3.2.0,M11.1.0";
+  if (*s != ',' || !(s = tz_parse_date(s + 1, &r->start))) return -1;
+  if (*s != ',' || !(s = tz_parse_date(s + 1, &r->end))) return -1;
+  return *s == '\0' ? 0 : -1;
+}
+
+// Local midnight of the day of year y a rule date falls on, as a wall clock time
+static int64_t tz_rule_day(const tz_date_t* d, int y) {
+  int leap = y % 4 == 0 && (y % 100 != 0 || y % 400 == 0);
+  int64_t jan1 = tz_year_start(y);
+
+  if (d->kind == 'J') return jan1 + (int64_t)(d->d - 1 + (leap && d->d > 59)) * 86400;
+  if (d->kind == 'N') return jan1 + (int64_t)d->d * 86400;
+
+  int64_t first = timestamp_to_epoch((timestamp_t){ .y = y, .m = d->m, .d = 1 });
+  int64_t next = d->m == 12 ? tz_year_start(y + 1) : timestamp_to_epoch((timestamp_t){ .y = y, .m = d->m + 1, .d = 1 });
+  // 1970-01-01 was a Thursday, weekdays go from 0 (Sunday)
+  int64_t days = first / 86400;
+  int wd = (int)(((days + 4) % 7 + 7) % 7);
+  int64_t day = first + (int64_t)((d->d - wd + 7) % 7 + (d->w - 1) * 7) * 86400;
+  while (day >= next) day -= 7 * 86400;
+  return day;
+}
+
+// Appends a change, unless it is not after the last one or keeps its offset
+static void tz_push(tz_times_t* at, tz_offsets_t* offset, int64_t t, int32_t off) {
+  if (at->count > 0 && (t <= at->items[at->count - 1] || off == offset->items[offset->count - 1])) return;
+
+  da_append(at, t);
+  da_append(offset, off);
+}
+
+// Parses a TZif file, version 2 and later use 64-bit times and end
+// with a POSIX rule for the times after the last transition.
+// @return 0 on success, < 0 if the file is malformed.
+static int tz_parse(tz_t* tz, const unsigned char* data, size_t size) {
+  if (size < 44 || memcmp(data, "TZif", 4) != 0) return -1;
+
+  int version = data[4];
+  size_t time_size = 4;
+  const unsigned char* p = data;
+  const unsigned char* end = data + size;
+
+  for (;;) {
+    if ((size_t)(end - p) < 44) return -1;
+    size_t isutcnt = (uint32_t)tz_be32(p + 20);
+    size_t isstdcnt = (uint32_t)tz_be32(p + 24);
+    size_t leapcnt = (uint32_t)tz_be32(p + 28);
+    size_t timecnt = (uint32_t)tz_be32(p + 32);
+    size_t typecnt = (uint32_t)tz_be32(p + 36);
+    size_t charcnt = (uint32_t)tz_be32(p + 40);
+    size_t block = timecnt * time_size + timecnt + typecnt * 6 + charcnt
+                 + leapcnt * (time_size + 4) + isstdcnt + isutcnt;
+    if (typecnt == 0 || (size_t)(end - p - 44) < block) return -1;
+
+    // skip the 32-bit block when there is a 64-bit one
+    if (version >= '2' && time_size == 4) {
+      p += 44 + block;
+      if ((size_t)(end - p) < 4 || memcmp(p, "TZif", 4) != 0) return -1;
+      time_size = 8;
+      continue;
+    }
+
+    const unsigned char* times = p + 44;
+    const unsigned char* types = times + timecnt * time_size;
+    const unsigned char* infos = types + timecnt;
+
+    tz_times_t at = { 0 };
+    tz_offsets_t offset = { 0 };
+    tz->initial = tz_be32(infos);
+    for (size_t i = 0; i < timecnt; i++) {
+      if (types[i] >= typecnt) {
+        da_free(at);
+        da_free(offset);
+        return -1;
+      }
+      int64_t t = time_size == 8 ? tz_be64(times + i * 8) : tz_be32(times + i * 4);
+      int32_t off = tz_be32(infos + types[i] * 6);
+      if (at.count == 0 && off == tz->initial) continue;
+      tz_push(&at, &offset, t, off);
+    }
+
+    // POSIX rule between two newlines after the block
+    const unsigned char* footer = p + 44 + block;
+    if (version >= '2' && footer < end && *footer == '\n') {
+      const unsigned char* nl = memchr(footer + 1, '\n', (size_t)(end - footer - 1));
+      char rule_text[128];
+      size_t len = nl ? (size_t)(nl - footer - 1) : 0;
+      tz_rule_t rule;
+      if (nl && len > 0 && len < sizeof(rule_text)) {
+        memcpy(rule_text, footer + 1, len);
+        rule_text[len] = '\0';
+        if (tz_parse_rule(rule_text, &rule) == 0 && rule.has_dst) {
+          int first = at.count > 0 ? timestamp_from_epoch(at.items[at.count - 1]).y : TZ_FIRST_YEAR;
+          for (int y = first; y <= TZ_LAST_YEAR; y++) {
+            // the change to DST happens in standard time and back
+            int64_t start = tz_rule_day(&rule.start, y) + rule.start.time - rule.std;
+            int64_t stop = tz_rule_day(&rule.end, y) + rule.end.time - rule.dst;
+            if (start < stop) {
+              tz_push(&at, &offset, start, rule.dst);
+              tz_push(&at, &offset, stop, rule.std);
+            } else {
+              tz_push(&at, &offset, stop, rule.std);
+              tz_push(&at, &offset, start, rule.dst);
+            }
+          }
+        }
+      }
+    }
+
+    tz->at = at.items;
+    tz->offset = offset.items;
+    tz->count = at.count;
+    break;
+  }
+
+  size_t i = 0;
+  for (int y = TZ_FIRST_YEAR; y <= TZ_LAST_YEAR; y++) {
+    int64_t start = tz_year_start(y);
+    while (i < tz->count && tz->at[i] < start) i++;
+    tz->year_first[y - TZ_FIRST_YEAR] = (uint32_t)i;
+  }
+  return 0;
+}
+
+int64_t tz_offset(const tz_t* tz, int64_t t) {
+  size_t i = 0;
+  int y = timestamp_from_epoch(t).y;
+  if (y >= TZ_FIRST_YEAR && y <= TZ_LAST_YEAR) {
+    i = tz->year_first[y - TZ_FIRST_YEAR];
+    while (i < tz->count && tz->at[i] <= t) i++;
+  } else {
+    // first change after t
+    size_t lo = 0, hi = tz->count;
+    while (lo < hi) {
+      size_t mid = lo + (hi - lo) / 2;
+      if (tz->at[mid] <= t) lo = mid + 1;
+      else hi = mid;
+    }
+    i = lo;
+  }
+  return i > 0 ? tz->offset[i - 1] : tz->initial;
+}
+
+int64_t tz_local_to_utc(const tz_t* tz, int64_t t) {
+  // the offsets before and after t, the same unless it changes around t
+  int64_t before = tz_offset(tz, t - 86400);
+  int64_t after = tz_offset(tz, t + 86400);
+  if (tz_offset(tz, t - before) == before) return t - before;
+  if (tz_offset(tz, t - after) == after) return t - after;
+  // skipped by a forward change, read with the offset before it
+  return t - before;
+}
+
+typedef struct {
+  char id[TZ_ID_MAX];
+  // NULL if the zone could not be loaded
+  tz_t* tz;
+} tz_entry_t;
+
+static struct {
+  tz_entry_t* items;
+  size_t count;
+  size_t capacity;
+} tz_cache;
+
+#ifdef _WIN32
+static SRWLOCK tz_lock = SRWLOCK_INIT;
+#define TZ_LOCK() AcquireSRWLockExclusive(&tz_lock)
+#define TZ_UNLOCK() ReleaseSRWLockExclusive(&tz_lock)
+#else
+static pthread_mutex_t tz_lock = PTHREAD_MUTEX_INITIALIZER;
+#define TZ_LOCK() pthread_mutex_lock(&tz_lock)
+#define TZ_UNLOCK() pthread_mutex_unlock(&tz_lock)
+#endif
+
+// Names are paths under the zoneinfo directory, nothing may escape it
+static int tz_valid_name(const char* name) {
+  if (*name == '\0' || *name == '/' || strstr(name, "..")) return 0;
+  for (const char* c = name; *c; c++) {
+    if (!isalnum((unsigned char)*c) && !strchr("/_+-", *c)) return 0;
+  }
+  return 1;
+}
+
+static tz_t* tz_load(const char* name) {
+  if (!tz_valid_name(name)) return NULL;
+
+  const char* dir = getenv("TZDIR");
+  if (!dir || *dir == '\0') dir = TZ_DEFAULT_DIR;
+
+  char path[512];
+  int len = snprintf(path, sizeof(path), "%s/%s", dir, name);
+  if (len < 0 || (size_t)len >= sizeof(path)) return NULL;
+
+  sb_t file = { 0 };
+  if (sb_read_file(path, &file) <= 0) {
+    if (file.items) sb_free(&file);
+    return NULL;
+  }
+
+  tz_t* tz = calloc(1, sizeof(*tz));
+  if (tz && tz_parse(tz, (const unsigned char*)file.items, file.count) < 0) {
+    LOG_WARN("Malformed zoneinfo file `%s`", path);
+    free(tz);
+    tz = NULL;
+  }
+  sb_free(&file);
+  return tz;
+}
+
+const tz_t* tz_get(slice_t tzid) {
+  slice_trim(&tzid);
+  if (tzid.size >= 2 && tzid.data[0] == '"' && tzid.data[tzid.size - 1] == '"') {
+    tzid.data++;
+    tzid.size -= 2;
+  }
+  if (tzid.size == 0 || tzid.size >= TZ_ID_MAX) return NULL;
+
+  char id[TZ_ID_MAX];
+  memcpy(id, tzid.data, tzid.size);
+  id[tzid.size] = '\0';
+
+  TZ_LOCK();
+  tz_t* tz = NULL;
+  for (size_t i = 0; i < tz_cache.count; i++) {
+    if (strcmp(tz_cache.items[i].id, id) == 0) {
+      tz = tz_cache.items[i].tz;
+      TZ_UNLOCK();
+      return tz;
+    }
+  }
+
+  // "/mozilla.org/20070129_1/Europe/Rome" is tried as "Europe/Rome" too
+  for (const char* name = id; name && !tz; name = strchr(name, '/')) {
+    if (*name == '/') name++;
+    tz = tz_load(name);
+  }
+  if (!tz) LOG_WARN("Unknown TZID `%s`, its times are read as local time.", id);
+
+  tz_entry_t entry = { .tz = tz };
+  memcpy(entry.id, id, tzid.size + 1);
+  da_append(&tz_cache, entry);
+  TZ_UNLOCK();
+  return tz;
+}
+
+void tz_cache_free(void) {
+  TZ_LOCK();
+  for (size_t i = 0; i < tz_cache.count; i++) {
+    tz_t* tz = tz_cache.items[i].tz;
+    if (!tz) continue;
+    free(tz->at);
+    free(tz->offset);
+    free(tz);
+  }
+  da_free(tz_cache);
+  memset(&tz_cache, 0, sizeof(tz_cache));
+  TZ_UNLOCK();
+}
@@ -0,0 +1,59 @@
+#ifndef TZ_H
+#define TZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "slice.h"
+
+// years indexed by tz_t, the POSIX rule of a zone is expanded up to the last one
+#define TZ_FIRST_YEAR 1970
+#define TZ_LAST_YEAR  2100
+
+/*
+ * Time zone compiled from a TZif file of the system zoneinfo
+ * (RFC 8536). Only the changes of UTC offset are kept, with the
+ * POSIX rule at the end of the file expanded up to TZ_LAST_YEAR.
+ * Zones never change once loaded, they can be shared by threads.
+ */
+typedef struct {
+  // offset before the first change, local time minus UTC
+  int32_t initial;
+  // UTC instants where the offset changes, in order
+  int64_t* at;
+  // offset from at[i] on
+  int32_t* offset;
+  size_t count;
+  // index of the first change of each year in [TZ_FIRST_YEAR, TZ_LAST_YEAR]
+  uint32_t year_first[TZ_LAST_YEAR - TZ_FIRST_YEAR + 1];
+} tz_t;
+
+/*
+ * Finds the zone of a TZID parameter, loading it the first time it is
+ * asked for. Quotes and prefixes like "/mozilla.org/20070129_1/" are
+ * dropped. Safe to call from several threads.
+ * @param tzid value of the TZID parameter
+ * @return the zone, NULL if there is no zoneinfo file for it.
+ */
+const tz_t* tz_get(slice_t tzid);
+/*
+ * @param tz zone returned by tz_get
+ * @param t seconds since the Unix epoch
+ * @return local time minus UTC at t, in seconds.
+ */
+int64_t tz_offset(const tz_t* tz, int64_t t);
+/*
+ * Converts a wall clock time of the zone to UTC. Times skipped by a
+ * change are read with the offset before it, repeated ones resolve
+ * to the first.
+ * @param tz zone returned by tz_get
+ * @param t seconds since 1970-01-01T00:00:00, wall clock time
+ * @return seconds since the Unix epoch.
+ */
+int64_t tz_local_to_utc(const tz_t* tz, int64_t t);
+/*
+ * Frees every zone loaded by tz_get.
+ */
+void tz_cache_free(void);
+
+#endif // TZ_H